@@ -5,110 +5,1518 @@
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Instruction.h"
 #include "llvm/IR/InstrTypes.h"
+#include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/Operator.h"
 #include "llvm/IR/Constants.h"
+#include "llvm/IR/Dominators.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/PatternMatch.h"
+#include "llvm/ADT/APFloat.h"
+#include "llvm/ADT/APInt.h"
+#include "llvm/ADT/APSInt.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Analysis/LazyBlockFrequencyInfo.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Analysis/ProfileSummaryInfo.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Transforms/Utils/BuildLibCalls.h"
 #include <optional>
 
 using namespace llvm;
+using namespace llvm::PatternMatch;
+
+#define DEBUG_TYPE "matf-arit-sr"
+
+STATISTIC(NumMulToShl, "Number of multiplications replaced with a shift");
+STATISTIC(NumMulToShiftAdd, "Number of multiplications replaced with shifts and adds");
+STATISTIC(NumDivToShr, "Number of divisions replaced with a shift");
+STATISTIC(NumDivToMagic, "Number of divisions replaced with a multiplication by a magic number");
+STATISTIC(NumRemToAnd, "Number of remainders replaced with a mask");
+STATISTIC(NumRemToMagic, "Number of remainders replaced with a multiplication by a magic number");
+STATISTIC(NumDivByInvariant, "Number of divisions by a loop invariant replaced with a magic number calculated before the loop");
+STATISTIC(NumRemByInvariant, "Number of remainders by a loop invariant replaced with a magic number calculated before the loop");
+STATISTIC(NumShiftsFolded, "Number of shifts and masks folded into the shift or mask before them");
+STATISTIC(NumFDivToFMul, "Number of floating point divisions replaced with a multiplication");
+STATISTIC(NumFDivHoisted, "Number of floating point divisions by a loop invariant replaced with a multiplication");
+STATISTIC(NumFMulToFAdd, "Number of floating point multiplications by 2 replaced with an addition");
+STATISTIC(NumNotHot, "Number of instructions not replaced with a longer sequence because their block is not hot");
+STATISTIC(NumPowToMul, "Number of pow calls replaced with multiplications");
+STATISTIC(NumPowToSqrt, "Number of pow(x, 0.5) calls replaced with sqrt");
+STATISTIC(NumExp2ToLdexp, "Number of exp2 calls of an integer replaced with ldexp");
+
+static cl::opt<unsigned> MulCostScale(
+    "matf-arit-sr-mul-cost-scale", cl::init(2), cl::Hidden,
+    cl::desc("Multiply the target cost of a mul by this factor before comparing it "
+             "with a shift-and-add sequence (a mul has more latency than its throughput cost shows)"));
+
+static cl::opt<unsigned> MaxExtraMulInstructions(
+    "matf-arit-sr-max-extra-insts", cl::init(64), cl::Hidden,
+    cl::desc("Maximum number of extra instructions per function added by "
+             "decomposing multiplications into shifts and adds"));
+
+static cl::opt<bool> ReduceFloatingPoint(
+    "matf-arit-sr-float", cl::init(true), cl::Hidden,
+    cl::desc("Reduce floating point divisions and multiplications (exact replacements "
+             "always, the ones that round differently only with the arcp flag)"));
+
+static cl::opt<bool> ReduceInvariantDivisors(
+    "matf-arit-sr-invariant-divisors", cl::init(true), cl::Hidden,
+    cl::desc("Replace unsigned division and modulo by a loop invariant value with a "
+             "multiplication by a magic number calculated before the loop"));
+
+static cl::opt<unsigned> HotCutoff(
+    "matf-arit-sr-hot-cutoff", cl::init(990000), cl::Hidden,
+    cl::desc("With a profile, only blocks that are among the hottest ones making up this many "
+             "parts per million of the profile get replacements longer than the instruction "
+             "(magic numbers, shifts and adds)"));
+
+static cl::opt<bool> ReduceLibCalls(
+    "matf-arit-sr-libcalls", cl::init(true), cl::Hidden,
+    cl::desc("Replace pow and exp2 calls with a constant or an integer argument "
+             "with multiplications, sqrt or ldexp"));
+
+static cl::opt<unsigned> MaxPowExponent(
+    "matf-arit-sr-max-pow-exponent", cl::init(32), cl::Hidden,
+    cl::desc("Largest integer exponent of pow that is replaced with multiplications"));
 
 namespace
 {
-    struct ArithmeticStrengthReductionPass : public FunctionPass
+    /*
+     * Everything that changes while a function is reduced is kept here, and a new
+     * one is made for every function. The pass itself has no state, so different
+     * functions can be reduced at the same time (see StrengthReductionDriver).
+     */
+    struct ArithmeticStrengthReduction
     {
         std::vector<Instruction *> InstructionsToRemove;
+        SmallPtrSet<Instruction *, 16> RemovedInstructions;
+        SmallVector<Instruction *, 32> Worklist;
+        SmallPtrSet<Instruction *, 32> InWorklist;
+        SmallPtrSet<Instruction *, 16> ReportedMissed;
+        // Divisor, loop -> 1 / divisor calculated in the preheader of the loop
+        DenseMap<std::pair<Value *, Loop *>, Value *> Reciprocals;
+        // Divisor, loop -> magic number of the divisor calculated in the preheader of the loop
+        struct RuntimeMagic {
+            Value *multiplier;
+            Value *shift1;
+            Value *shift2;
+        };
+        DenseMap<std::pair<Value *, Loop *>, RuntimeMagic> RuntimeMagics;
+        const TargetTransformInfo *TTI;
+        const TargetLibraryInfo *TLI;
+        const DataLayout *DL;
+        LoopInfo *LI;
+        DominatorTree *DT;
+        OptimizationRemarkEmitter *ORE;
+        ProfileSummaryInfo *PSI;
+        // Only when there is a profile
+        BlockFrequencyInfo *BFI;
+        unsigned ExtraInstructions = 0;
 
-        static char ID; // Pass identification, replacement for typeid
-        ArithmeticStrengthReductionPass() : FunctionPass(ID) {}
+        ArithmeticStrengthReduction(const TargetTransformInfo *TTI, const TargetLibraryInfo *TLI, const DataLayout *DL,
+                                    LoopInfo *LI, DominatorTree *DT, OptimizationRemarkEmitter *ORE,
+                                    ProfileSummaryInfo *PSI, BlockFrequencyInfo *BFI)
+            : TTI(TTI), TLI(TLI), DL(DL), LI(LI), DT(DT), ORE(ORE), PSI(PSI), BFI(BFI) {}
 
-        bool runOnFunction(Function &F) override
+        /*
+         * Every instruction is visited once, in order. When an instruction is replaced,
+         * its users are visited again, because the new value may give them something
+         * to reduce or fold (a division of a shift, a shift of a shift). Only the users
+         * of replaced values come back, so the work stays linear in the size of the function.
+         */
+        bool reduceFunction(Function &F)
         {
-            bool modified = false;
-
-            InstructionsToRemove.clear();
-
-            for (BasicBlock &BB : F)
+            for (BasicBlock &BB : reverse(F))
             {
-                for (Instruction &Instr : BB)
+                for (Instruction &Instr : reverse(BB))
                 {
-                    if(isa<SDivOperator>(Instr) || isa<UDivOperator>(Instr)) {
-                        reduceDiv(&Instr);
-                    }
+                    addToWorklist(&Instr);
+                }
+            }
 
-                    if (isa<MulOperator>(Instr)) {
-                        reduceMult(&Instr);
-                    }
+            while (!Worklist.empty())
+            {
+                Instruction *Instr = Worklist.pop_back_val();
+                InWorklist.erase(Instr);
+                if (RemovedInstructions.count(Instr)) {
+                    continue;
+                }
 
-                    if(Instr.getOpcode() == llvm::Instruction::BinaryOps::URem || Instr.getOpcode() == llvm::Instruction::BinaryOps::SRem) {
-                        reduceModulo(&Instr);
-                    }
+                if(isa<SDivOperator>(Instr) || isa<UDivOperator>(Instr)) {
+                    reduceDiv(Instr);
+                }
+
+                if (isa<MulOperator>(Instr)) {
+                    reduceMult(Instr);
+                }
+
+                if(Instr->getOpcode() == llvm::Instruction::BinaryOps::URem || Instr->getOpcode() == llvm::Instruction::BinaryOps::SRem) {
+                    reduceModulo(Instr);
+                }
+
+                if (Instr->isShift() || Instr->getOpcode() == Instruction::And) {
+                    foldShiftChain(Instr);
+                }
+
+                if (ReduceFloatingPoint && Instr->getOpcode() == Instruction::FDiv) {
+                    reduceFDiv(Instr);
+                }
+
+                if (ReduceFloatingPoint && Instr->getOpcode() == Instruction::FMul) {
+                    reduceFMul(Instr);
+                }
+
+                if (ReduceLibCalls && isa<CallInst>(Instr)) {
+                    reduceLibCall(cast<CallInst>(Instr));
                 }
             }
 
+            // Removed instructions may still use each other
+            for (Instruction *Instr : InstructionsToRemove)
+            {
+                Instr->dropAllReferences();
+            }
             for (Instruction *Instr : InstructionsToRemove)
             {
                 Instr->eraseFromParent();
-                modified = true;
             }
 
-            return modified;
+            return !InstructionsToRemove.empty();
+        }
+
+        void addToWorklist(Value *V)
+        {
+            auto *Instr = dyn_cast<Instruction>(V);
+            if (Instr && !RemovedInstructions.count(Instr) && InWorklist.insert(Instr).second) {
+                Worklist.push_back(Instr);
+            }
+        }
+
+        void removeInstruction(Instruction *Instr)
+        {
+            if (RemovedInstructions.insert(Instr).second) {
+                InstructionsToRemove.push_back(Instr);
+            }
+        }
+
+        /*
+         * Replaces the instruction (it's erased after the whole function is visited),
+         * counts it and reports it with -pass-remarks=matf-arit-sr:
+         *     sdiv by 7 replaced with a multiplication by a magic number
+         */
+        void replaceInstruction(Instruction *Instr, Value *newInst, Value *constant, Statistic &counter,
+                                StringRef remarkName, StringRef replacement)
+        {
+            LLVM_DEBUG(dbgs() << "Replacing" << *Instr << "\n     with " << *newInst << "\n");
+
+            ORE->emit([&]() {
+                return OptimizationRemark(DEBUG_TYPE, remarkName, Instr)
+                       << ore::NV("Opcode", Instr->getOpcodeName()) << " by "
+                       << ore::NV("Constant", constant) << " replaced with " << replacement;
+            });
+
+            replaceUses(Instr, newInst, counter);
+        }
+
+        // Same for calls, the remark names the function: pow replaced with multiplications
+        void replaceCall(CallInst *Call, Value *newInst, Statistic &counter, StringRef remarkName, StringRef replacement)
+        {
+            LLVM_DEBUG(dbgs() << "Replacing" << *Call << "\n     with " << *newInst << "\n");
+
+            ORE->emit([&]() {
+                return OptimizationRemark(DEBUG_TYPE, remarkName, Call)
+                       << ore::NV("Callee", Call->getCalledFunction()) << " replaced with " << replacement;
+            });
+
+            replaceUses(Call, newInst, counter);
+        }
+
+        void replaceUses(Instruction *Instr, Value *newInst, Statistic &counter)
+        {
+            ++counter;
+            SmallVector<User *, 8> users(Instr->users());
+            Instr->replaceAllUsesWith(newInst);
+            removeInstruction(Instr);
+
+            addToWorklist(newInst);
+            for (User *user : users) {
+                addToWorklist(user);
+            }
+        }
+
+        /*
+         * With a profile (-fprofile-use), replacements that are longer than the instruction
+         * (magic numbers, shifts and adds, magic numbers and reciprocals calculated before
+         * the loop, the rounding bias of signed division and remainder by powers of two)
+         * are made only in hot blocks. Cold code stays small, it gets only the replacements
+         * that are not longer (unsigned shifts and masks for constant powers of two, folded
+         * shifts) and the ones by variable powers of two that take one more instruction
+         * (x >> cttz(d), x & (d - 1)).
+         */
+        bool isHot(Instruction *Instr)
+        {
+            if (!BFI || PSI->isHotBlockNthPercentile(HotCutoff, Instr->getParent(), BFI)) {
+                return true;
+            }
+
+            ++NumNotHot;
+            reportMissed(Instr, "NotHot", "the replacement is longer than the instruction, and the block is not hot");
+            return false;
+        }
+
+        // Shows up with -pass-remarks-missed=matf-arit-sr
+        void reportMissed(Instruction *Instr, StringRef remarkName, StringRef reason)
+        {
+            // Instructions can be visited more than once
+            if (!ReportedMissed.insert(Instr).second) {
+                return;
+            }
+
+            LLVM_DEBUG(dbgs() << "Not reducing" << *Instr << ": " << reason << "\n");
+
+            ORE->emit([&]() {
+                return OptimizationRemarkMissed(DEBUG_TYPE, remarkName, Instr)
+                       << ore::NV("Opcode", Instr->getOpcodeName()) << " not reduced: " << reason;
+            });
         }
 
         void reduceMult(Instruction *Instr) 
         {
             IRBuilder<> builder(&*Instr);
 
-            auto leftOp = TryGetConstantInt(Instr->getOperand(0));
-            auto rightOp = TryGetConstantInt(Instr->getOperand(1));
+            Value *variable = Instr->getOperand(0);
+            Value *constant = Instr->getOperand(1);
+            if (isa<Constant>(variable)) {
+                std::swap(variable, constant);
+            }
+
+            // Non-uniform vector of powers of two, every lane is shifted by its own amount
+            if (Constant *shifts = getPerLaneShiftAmounts(constant, false)) {
+                if (hasCheapPerLaneOperation(Instr, Instruction::Shl)) {
+                    // nsw isn't kept, a lane might be multiplied by INT_MIN
+                    Value *newInst = builder.CreateShl(variable, shifts, "", Instr->hasNoUnsignedWrap());
+                    replaceInstruction(Instr, newInst, constant, NumMulToShl, "MulToShl", "a shift");
+                } else {
+                    reportMissed(Instr, "PerLaneShift", "shifts by a different amount in every lane are expensive on this target");
+                }
+                return;
+            }
+
+            auto constantOp = TryGetConstantInt(constant);
+            if (!constantOp) {
+                return;
+            }
+
+            if (isPowerOfTwo(*constantOp)) {
+                int64_t powOfTwo = findPowerOfTwo(*constantOp);
+                Value *newInst = builder.CreateShl(variable, powOfTwo, "", Instr->hasNoUnsignedWrap(), Instr->hasNoSignedWrap());
+                replaceInstruction(Instr, newInst, constant, NumMulToShl, "MulToShl", "a shift");
+                return;
+            }
+
+            if (!isHot(Instr)) {
+                return;
+            }
+
+            Value *newInst = createMulByConstant(builder, Instr, variable, *TryGetConstantAPInt(constant));
+            if (newInst) {
+                replaceInstruction(Instr, newInst, constant, NumMulToShiftAdd, "MulToShiftAdd", "shifts and adds");
+            }
+        }
 
-            if(leftOp) {
-                if (isPowerOfTwo(*leftOp)) {
-                    int64_t powOfTwo = findPowerOfTwo(*leftOp);
-                    Value *newInst = builder.CreateShl(Instr->getOperand(1), powOfTwo);
-                    Instr->replaceAllUsesWith(newInst);
-                    InstructionsToRemove.push_back(Instr);
+        /*
+         * x / 4.0 is exactly x * 0.25: both are the same real number rounded once, so they
+         * are equal for every x, NaN, infinities, denormals and -0.0 included. For other
+         * constants the reciprocal itself is rounded and the result may differ in the last
+         * bit, which only the arcp (or fast) flag of the division allows.
+         */
+        void reduceFDiv(Instruction *Instr)
+        {
+            const APFloat *divisor;
+            if (!match(Instr->getOperand(1), m_APFloat(divisor))) {
+                reduceFDivByInvariant(Instr);
+                return;
+            }
+
+            APFloat reciprocal(divisor->getSemantics());
+            bool isExact = divisor->getExactInverse(&reciprocal);
+            if (!isExact) {
+                if (!Instr->hasAllowReciprocal()) {
+                    reportMissed(Instr, "FDivInexact", "the reciprocal of the divisor is not an exact normal number and the division has no arcp flag");
+                    return;
                 }
-            } else if (rightOp) {
-                if (isPowerOfTwo(*rightOp)) {
-                    int64_t powOfTwo = findPowerOfTwo(*rightOp);
-                    Value *newInst = builder.CreateShl(Instr->getOperand(0), powOfTwo);
-                    Instr->replaceAllUsesWith(newInst);
-                    InstructionsToRemove.push_back(Instr);
+
+                // 1 / x of a huge x or of a denormal is not a normal number, x / 0 stays too
+                reciprocal = APFloat(divisor->getSemantics(), 1);
+                reciprocal.divide(*divisor, APFloat::rmNearestTiesToEven);
+                if (!reciprocal.isNormal()) {
+                    return;
                 }
             }
+
+            IRBuilder<> builder(Instr);
+            builder.setFastMathFlags(Instr->getFastMathFlags());
+            Value *newInst = builder.CreateFMul(Instr->getOperand(0), ConstantFP::get(Instr->getType(), reciprocal));
+            replaceInstruction(Instr, newInst, Instr->getOperand(1), NumFDivToFMul, "FDivToFMul",
+                               isExact ? "an exact multiplication" : "a multiplication by the reciprocal");
         }
 
+        /*
+         * x / d in a loop where d doesn't change: 1 / d is calculated once before the loop
+         * (the outermost one d doesn't change in) and the division becomes a multiplication.
+         * That's rounded twice, so it's done only with arcp. The reciprocal is shared
+         * by all the divisions by d in the loop.
+         */
+        void reduceFDivByInvariant(Instruction *Instr)
+        {
+            Value *divisor = Instr->getOperand(1);
+            Loop *loop = LI->getLoopFor(Instr->getParent());
+            if (!loop || !loop->isLoopInvariant(divisor)) {
+                return;
+            }
+
+            if (!Instr->hasAllowReciprocal()) {
+                reportMissed(Instr, "FDivNoArcp", "the divisor doesn't change in the loop, but the division has no arcp flag");
+                return;
+            }
+            if (!isHot(Instr)) {
+                return;
+            }
+
+            while (loop->getParentLoop() && loop->getParentLoop()->isLoopInvariant(divisor) &&
+                   loop->getParentLoop()->getLoopPreheader()) {
+                loop = loop->getParentLoop();
+            }
+
+            BasicBlock *preheader = loop->getLoopPreheader();
+            if (!preheader) {
+                return;
+            }
+
+            Value *&reciprocal = Reciprocals[std::make_pair(divisor, loop)];
+            if (!reciprocal) {
+                // Correctly rounded, it doesn't need the flags of any of the divisions
+                IRBuilder<> preheaderBuilder(preheader->getTerminator());
+                reciprocal = preheaderBuilder.CreateFDiv(ConstantFP::get(divisor->getType(), 1.0), divisor, "matf.recip");
+            }
+
+            IRBuilder<> builder(Instr);
+            builder.setFastMathFlags(Instr->getFastMathFlags());
+            Value *newInst = builder.CreateFMul(Instr->getOperand(0), reciprocal);
+            replaceInstruction(Instr, newInst, divisor, NumFDivHoisted, "FDivHoisted",
+                               "a multiplication by its reciprocal calculated before the loop");
+        }
+
+        // x * 2.0 is exactly x + x, for every x
+        void reduceFMul(Instruction *Instr)
+        {
+            Value *variable;
+            const APFloat *constant;
+            if (!match(Instr, m_c_FMul(m_Value(variable), m_APFloat(constant))) || !constant->isExactlyValue(2.0)) {
+                return;
+            }
+
+            TargetTransformInfo::TargetCostKind costKind = TargetTransformInfo::TCK_RecipThroughput;
+            InstructionCost addCost = TTI->getArithmeticInstrCost(Instruction::FAdd, Instr->getType(), costKind);
+            InstructionCost mulCost = TTI->getArithmeticInstrCost(Instruction::FMul, Instr->getType(), costKind);
+            if (!addCost.isValid() || !mulCost.isValid() || addCost > mulCost) {
+                return;
+            }
+
+            IRBuilder<> builder(Instr);
+            builder.setFastMathFlags(Instr->getFastMathFlags());
+            Value *newInst = builder.CreateFAdd(variable, variable);
+            Value *two = Instr->getOperand(Instr->getOperand(0) == variable ? 1 : 0);
+            replaceInstruction(Instr, newInst, two, NumFMulToFAdd, "FMulToFAdd", "an addition");
+        }
+
+        /*
+         * Calls of pow and exp2 from libm (or their intrinsics) whose argument makes them simple:
+         *     pow(x, 0) = 1, pow(x, 1) = x, pow(x, 2) = x * x, pow(x, -1) = 1 / x
+         *     pow(x, 5) = (x * x) * (x * x) * x           (with afn or reassoc)
+         *     pow(x, 0.5) = sqrt(x)
+         *     exp2((double)n) = ldexp(1.0, n)
+         * Library functions are recognized by TargetLibraryInfo, so a function of the
+         * program that is just named pow isn't touched.
+         */
+        void reduceLibCall(CallInst *Call)
+        {
+            if (!Call->getType()->isFloatingPointTy() || !Call->getCalledFunction()) {
+                return;
+            }
+
+            LibFunc func;
+            bool isLibCall = TLI->getLibFunc(*Call, func) && TLI->has(func);
+            Intrinsic::ID intrinsic = Call->getIntrinsicID();
+
+            if (intrinsic == Intrinsic::pow ||
+                (isLibCall && (func == LibFunc_pow || func == LibFunc_powf || func == LibFunc_powl))) {
+                reducePow(Call);
+            } else if (intrinsic == Intrinsic::exp2 ||
+                       (isLibCall && (func == LibFunc_exp2 || func == LibFunc_exp2f || func == LibFunc_exp2l))) {
+                reduceExp2(Call);
+            }
+        }
+
+        /*
+         * The results for 0, 1, 2 and -1 are rounded once, just like pow rounds them, so they're
+         * always replaced (LLVM does the same, even if pow would set errno on overflow).
+         * Longer chains round after every multiplication, that needs afn or reassoc, and a pow
+         * that doesn't set errno (the intrinsic, or the call with -fno-math-errno).
+         */
+        void reducePow(CallInst *Call)
+        {
+            Value *base = Call->getArgOperand(0);
+            Value *exponentOperand = Call->getArgOperand(1);
+            const APFloat *exponent;
+            if (!match(exponentOperand, m_APFloat(exponent))) {
+                return;
+            }
+
+            Type *type = Call->getType();
+            bool setsErrno = Call->getIntrinsicID() != Intrinsic::pow && !Call->doesNotAccessMemory();
+            IRBuilder<> builder(Call);
+            builder.setFastMathFlags(Call->getFastMathFlags());
+
+            if (exponent->isExactlyValue(0.5)) {
+                if (Value *root = createPowHalf(Call, builder, setsErrno)) {
+                    replaceCall(Call, root, NumPowToSqrt, "PowToSqrt", "sqrt");
+                }
+                return;
+            }
+
+            APSInt integer(32, false);
+            bool isExact;
+            if (exponent->convertToInteger(integer, APFloat::rmTowardZero, &isExact) != APFloat::opOK || !isExact) {
+                return;
+            }
+
+            int64_t n = integer.getSExtValue();
+            Value *newInst;
+            if (n == 0) {
+                newInst = ConstantFP::get(type, 1.0);
+            } else if (n == 1) {
+                newInst = base;
+            } else if (n == 2) {
+                newInst = builder.CreateFMul(base, base);
+            } else if (n == -1) {
+                newInst = builder.CreateFDiv(ConstantFP::get(type, 1.0), base);
+            } else {
+                if (!(Call->hasApproxFunc() || Call->hasAllowReassoc()) || setsErrno) {
+                    reportMissed(Call, "PowInexact", "multiplications round differently than pow, it needs afn or reassoc and no errno");
+                    return;
+                }
+                if (uint64_t(std::abs(n)) > MaxPowExponent) {
+                    reportMissed(Call, "PowExponentTooBig", "the exponent is too big");
+                    return;
+                }
+
+                newInst = createPowChain(builder, base, std::abs(n));
+                if (n < 0) {
+                    newInst = builder.CreateFDiv(ConstantFP::get(type, 1.0), newInst);
+                }
+            }
+
+            replaceCall(Call, newInst, NumPowToMul, "PowToMul", "multiplications");
+        }
+
+        // x^n by squaring: x^13 = x^8 * x^4 * x, a square for every bit and a multiplication for every set bit
+        Value *createPowChain(IRBuilder<> &builder, Value *base, uint64_t n)
+        {
+            Value *result = nullptr;
+            Value *power = base;
+            while (true) {
+                if (n & 1) {
+                    result = result ? builder.CreateFMul(result, power) : power;
+                }
+                n >>= 1;
+                if (n == 0) {
+                    return result;
+                }
+                power = builder.CreateFMul(power, power);
+            }
+        }
+
+        /*
+         * pow(x, 0.5) is sqrt(x) except for -0.0 (pow gives +0.0, fixed with fabs) and -inf (pow
+         * gives +inf, fixed with a select). nsz and ninf say they don't matter. A pow that sets errno
+         * becomes a libm sqrt, which sets it for the same negative numbers, but only with ninf,
+         * sqrt(-inf) would set it where pow doesn't.
+         */
+        Value *createPowHalf(CallInst *Call, IRBuilder<> &builder, bool setsErrno)
+        {
+            Value *base = Call->getArgOperand(0);
+            Type *type = Call->getType();
+
+            Value *root;
+            if (!setsErrno) {
+                root = builder.CreateUnaryIntrinsic(Intrinsic::sqrt, base);
+            } else if (Call->hasNoInfs() && hasFloatFn(TLI, type, LibFunc_sqrt, LibFunc_sqrtf, LibFunc_sqrtl)) {
+                root = emitUnaryFloatFnCall(base, TLI, LibFunc_sqrt, LibFunc_sqrtf, LibFunc_sqrtl, builder,
+                                            AttributeList());
+            } else {
+                reportMissed(Call, "PowSetsErrno", "sqrt(-inf) would set errno, pow(-inf, 0.5) doesn't");
+                return nullptr;
+            }
+
+            if (!Call->hasNoSignedZeros()) {
+                root = builder.CreateUnaryIntrinsic(Intrinsic::fabs, root);
+            }
+            if (!Call->hasNoInfs()) {
+                Value *isMinusInfinity = builder.CreateFCmpOEQ(base, ConstantFP::getInfinity(type, true));
+                root = builder.CreateSelect(isMinusInfinity, ConstantFP::getInfinity(type), root);
+            }
+
+            return root;
+        }
+
+        // exp2 of an integer is exactly ldexp(1.0, n), without the exp and log inside exp2
+        void reduceExp2(CallInst *Call)
+        {
+            auto *conversion = dyn_cast<CastInst>(Call->getArgOperand(0));
+            if (!conversion || !hasFloatFn(TLI, Call->getType(), LibFunc_ldexp, LibFunc_ldexpf, LibFunc_ldexpl)) {
+                return;
+            }
+
+            // ldexp takes an int, unsigned values must fit into it too
+            Value *integer = conversion->getOperand(0);
+            unsigned intSize = TLI->getIntSize();
+            unsigned bitWidth = integer->getType()->getScalarSizeInBits();
+            bool isSigned = conversion->getOpcode() == Instruction::SIToFP;
+            if (!(isSigned && bitWidth <= intSize) && !(conversion->getOpcode() == Instruction::UIToFP && bitWidth < intSize)) {
+                return;
+            }
+
+            IRBuilder<> builder(Call);
+            builder.setFastMathFlags(Call->getFastMathFlags());
+            Type *intType = builder.getIntNTy(intSize);
+            Value *exponent = isSigned ? builder.CreateSExt(integer, intType) : builder.CreateZExt(integer, intType);
+            Value *newInst = emitBinaryFloatFnCall(ConstantFP::get(Call->getType(), 1.0), exponent, TLI, LibFunc_ldexp,
+                                                   LibFunc_ldexpf, LibFunc_ldexpl, builder, AttributeList());
+            replaceCall(Call, newInst, NumExp2ToLdexp, "Exp2ToLdexp", "ldexp");
+        }
+
+        // One term of the shift-and-add sequence: sign * (x << shift)
+        struct MulTerm {
+            unsigned shift;
+            bool isNegative;
+        };
+
+        /*
+         * Multiplication by a constant that is not a power of two is decomposed into
+         * shifts and adds/subs. The constant is split into c = c' * 2^k with c' odd,
+         * c' is built from its digits and the result is shifted left by k at the end:
+         *     x * 10 = (x + (x << 2)) << 1
+         *
+         * Both the binary digits and the canonical signed digits (no two adjacent
+         * non-zero digits, e.g. 7 = 8 - 1) are tried and the cheaper one is used.
+         * The sequence is only used if the target says it's not more expensive than
+         * the multiplication.
+         *
+         * Returns nullptr if the multiplication should stay.
+         */
+        Value *createMulByConstant(IRBuilder<> &builder, Instruction *Instr, Value *variable, const APInt &constant)
+        {
+            Type *type = Instr->getType();
+            unsigned bitWidth = constant.getBitWidth();
+            if (bitWidth > 64 || constant.isZero()) {
+                return nullptr;
+            }
+
+            unsigned trailingZeros = constant.countTrailingZeros();
+            APInt oddPart = constant.lshr(trailingZeros);
+
+            SmallVector<MulTerm, 8> terms = getBinaryDigits(oddPart);
+            unsigned sequenceLength = 0;
+            InstructionCost sequenceCost = estimateMulSequence(type, terms, trailingZeros, sequenceLength);
+
+            SmallVector<MulTerm, 8> signedTerms = getSignedDigits(oddPart);
+            unsigned signedLength = 0;
+            InstructionCost signedCost = estimateMulSequence(type, signedTerms, trailingZeros, signedLength);
+
+            if (signedCost < sequenceCost || (signedCost == sequenceCost && signedLength < sequenceLength)) {
+                terms = signedTerms;
+                sequenceCost = signedCost;
+                sequenceLength = signedLength;
+            }
+
+            InstructionCost mulCost = TTI->getArithmeticInstrCost(Instruction::Mul, type,
+                                                                  TargetTransformInfo::TCK_RecipThroughput,
+                                                                  TargetTransformInfo::OK_AnyValue,
+                                                                  TargetTransformInfo::OK_UniformConstantValue);
+
+            if (!sequenceCost.isValid() || !mulCost.isValid() || sequenceCost > mulCost * MulCostScale.getValue()) {
+                reportMissed(Instr, "MulTooExpensive", "shifts and adds are more expensive than the multiplication");
+                return nullptr;
+            }
+
+            // Keep the code size bounded, the mul itself is one instruction
+            if (ExtraInstructions + sequenceLength - 1 > MaxExtraMulInstructions) {
+                reportMissed(Instr, "MulSizeLimit", "limit of extra instructions in the function reached");
+                return nullptr;
+            }
+            ExtraInstructions += sequenceLength - 1;
+
+            // Start from a positive term so we don't need an extra negation
+            auto first = getFirstMulTerm(terms);
+
+            Value *result = first->shift > 0 ? builder.CreateShl(variable, first->shift) : variable;
+            if (first->isNegative) {
+                result = builder.CreateNeg(result);
+            }
+
+            for (auto term = terms.begin(); term != terms.end(); ++term) {
+                if (term == first) {
+                    continue;
+                }
+
+                Value *shifted = term->shift > 0 ? builder.CreateShl(variable, term->shift) : variable;
+                result = term->isNegative ? builder.CreateSub(result, shifted) : builder.CreateAdd(result, shifted);
+            }
+
+            if (trailingZeros > 0) {
+                result = builder.CreateShl(result, trailingZeros);
+            }
+
+            return result;
+        }
+
+        SmallVectorImpl<MulTerm>::const_iterator getFirstMulTerm(const SmallVectorImpl<MulTerm> &terms)
+        {
+            auto first = llvm::find_if(terms, [](const MulTerm &term) { return !term.isNegative; });
+            return first != terms.end() ? first : terms.begin();
+        }
+
+        /*
+         * Target cost of the shift-and-add sequence for the given terms. Adds of the
+         * form a + (x << 1..3) are counted as a single instruction when the target can
+         * fold them into an address computation (x86 lea), which makes *3, *5 and *9
+         * a single instruction.
+         */
+        InstructionCost estimateMulSequence(Type *type, const SmallVectorImpl<MulTerm> &terms,
+                                            unsigned trailingZeros, unsigned &length)
+        {
+            TargetTransformInfo::TargetCostKind costKind = TargetTransformInfo::TCK_RecipThroughput;
+            InstructionCost shlCost = TTI->getArithmeticInstrCost(Instruction::Shl, type, costKind);
+            InstructionCost addCost = TTI->getArithmeticInstrCost(Instruction::Add, type, costKind);
+
+            auto first = getFirstMulTerm(terms);
+            InstructionCost cost = 0;
+            length = 0;
+
+            for (auto term = terms.begin(); term != terms.end(); ++term) {
+                bool needsShift = term->shift > 0;
+                if (term == first) {
+                    // 0 - (x << s) if all the terms are negative
+                    cost += (needsShift ? shlCost : 0) + (term->isNegative ? addCost : 0);
+                    length += needsShift + term->isNegative;
+                    continue;
+                }
+
+                if (!term->isNegative && isFoldableIntoAddress(type, term->shift)) {
+                    cost += addCost;
+                } else {
+                    cost += (needsShift ? shlCost : 0) + addCost;
+                }
+                length += needsShift + 1;
+            }
+
+            if (trailingZeros > 0) {
+                cost += shlCost;
+                length++;
+            }
+
+            return cost;
+        }
+
+        // Can a + (x << shift) be computed as a single address computation?
+        bool isFoldableIntoAddress(Type *type, unsigned shift)
+        {
+            if (shift < 1 || shift > 3 || type->isVectorTy() || !TTI->isTypeLegal(type)) {
+                return false;
+            }
+
+            return TTI->isLegalAddressingMode(type, nullptr, 0, true, int64_t(1) << shift);
+        }
+
+        SmallVector<MulTerm, 8> getBinaryDigits(const APInt &constant)
+        {
+            SmallVector<MulTerm, 8> terms;
+            for (unsigned bit = 0; bit < constant.getBitWidth(); bit++) {
+                if (constant[bit]) {
+                    terms.push_back({bit, false});
+                }
+            }
+
+            return terms;
+        }
+
+        /*
+         * Non-adjacent form of the constant, modulo 2^N. Digits that would land above
+         * the bit width are dropped, which is fine because we're multiplying modulo 2^N.
+         *     7  -> +(x << 3), -(x << 0)
+         *     -3 -> +(x << 0), -(x << 2)
+         */
+        SmallVector<MulTerm, 8> getSignedDigits(const APInt &constant)
+        {
+            unsigned bitWidth = constant.getBitWidth();
+            uint64_t value = constant.getZExtValue();
+            SmallVector<MulTerm, 8> terms;
+
+            for (unsigned bit = 0; bit < bitWidth && value != 0; bit++, value >>= 1) {
+                if ((value & 1) == 0) {
+                    continue;
+                }
+
+                // ...11 becomes -1 and a carry, ...01 becomes +1
+                if ((value & 3) == 3) {
+                    terms.push_back({bit, true});
+                    value += 1;
+                } else {
+                    terms.push_back({bit, false});
+                    value -= 1;
+                }
+            }
+
+            return terms;
+        }
+
+        /*
+         * Division by a power of two is a right shift. Unsigned division (or signed
+         * division of a value that is known to be non-negative) is a plain shift.
+         *
+         * Signed division rounds towards zero and ashr rounds towards negative infinity,
+         * so for negative x we first add 2^k - 1 (-7 / 4 == (-7 + 3) >> 2 == -1):
+         *     bias = (x >> (k - 1)) >>> (N - k)     ; 2^k - 1 if x < 0, 0 otherwise
+         *     q    = (x + bias) >> k
+         */
         void reduceDiv(Instruction *Instr) 
         {
             IRBuilder<> builder(&*Instr);
 
-            auto rightOp = TryGetConstantInt(Instr->getOperand(1));
+            Value *dividend = Instr->getOperand(0);
+            bool isSigned = Instr->getOpcode() == Instruction::SDiv;
+            bool isExact = Instr->isExact();
+            bool isNonNegative = isSigned && isKnownNonNegative(dividend, *DL, 0, nullptr, Instr);
+
+            // Non-uniform vector of powers of two, every lane is shifted by its own amount.
+            // Without the bias only exact signed division can be done this way.
+            if (Constant *shifts = getPerLaneShiftAmounts(Instr->getOperand(1), isSigned)) {
+                Value *newInst = nullptr;
+                if ((!isSigned || isNonNegative) && hasCheapPerLaneOperation(Instr, Instruction::LShr)) {
+                    newInst = builder.CreateLShr(dividend, shifts, "", isExact);
+                } else if (isExact && hasCheapPerLaneOperation(Instr, Instruction::AShr)) {
+                    newInst = builder.CreateAShr(dividend, shifts, "", true);
+                }
+
+                if (newInst) {
+                    replaceInstruction(Instr, newInst, Instr->getOperand(1), NumDivToShr, "DivToShr", "a shift");
+                } else {
+                    reportMissed(Instr, "PerLaneShift", "no cheap per-lane shift that rounds the same way");
+                }
+                return;
+            }
+
+            const APInt *divisor = TryGetConstantAPInt(Instr->getOperand(1));
+            if (!divisor) {
+                if (!reduceByVariablePowerOf2(Instr, isNonNegative) && ReduceInvariantDivisors) {
+                    reduceByLoopInvariant(Instr, isNonNegative);
+                }
+                return;
+            }
+            if (divisor->isZero()) {
+                return;
+            }
+
+            // For a non-negative x and d, x / d is the same signed or unsigned
+            if (isNonNegative && !divisor->isNegative()) {
+                isSigned = false;
+            }
+
+            if (divisor->isPowerOf2() && !(isSigned && divisor->isNegative())) {
+                unsigned powOfTwo = divisor->logBase2();
+                unsigned bitWidth = divisor->getBitWidth();
+                Value *newInst;
 
-            if (rightOp) {
-                if (isPowerOfTwo(*rightOp)) {
-                    int64_t powOfTwo = findPowerOfTwo(*rightOp);
-                    Value *newInst = builder.CreateAShr(Instr->getOperand(0), powOfTwo);
-                    Instr->replaceAllUsesWith(newInst);
-                    InstructionsToRemove.push_back(Instr);
+                if (powOfTwo == 0) {
+                    newInst = dividend;
+                } else if (!isSigned) {
+                    newInst = builder.CreateLShr(dividend, powOfTwo, "", isExact);
+                } else if (isExact) {
+                    // Nothing is lost by shifting, no rounding needed
+                    newInst = builder.CreateAShr(dividend, powOfTwo, "", true);
+                } else if (!isHot(Instr)) {
+                    return;
+                } else {
+                    Value *sign = builder.CreateAShr(dividend, powOfTwo - 1);
+                    Value *bias = builder.CreateLShr(sign, bitWidth - powOfTwo);
+                    Value *biased = builder.CreateAdd(dividend, bias, "", false, true);
+                    newInst = builder.CreateAShr(biased, powOfTwo);
                 }
+                replaceInstruction(Instr, newInst, Instr->getOperand(1), NumDivToShr, "DivToShr", "a shift");
+                return;
+            }
+
+            // Not a power of two, divide by multiplying with the magic number
+            if (!isHot(Instr)) {
+                return;
+            }
+
+            Value *newInst = createDivByConstant(builder, dividend, Instr->getOperand(1), isSigned);
+            if (newInst) {
+                replaceInstruction(Instr, newInst, Instr->getOperand(1), NumDivToMagic, "DivToMagic",
+                                   "a multiplication by a magic number");
+            } else {
+                reportMissed(Instr, "UnsupportedType", "division by a constant is only reduced for 8 to 64 bit integers");
             }
         }
 
+        /*
+         * Modulo by a power of two is a mask for unsigned (or non-negative) x.
+         *
+         * Signed modulo takes the sign of x, so we round x towards zero to a multiple
+         * of 2^k (same bias as in reduceDiv) and subtract:
+         *     r = x - ((x + bias) & -2^k)
+         */
         void reduceModulo(Instruction *Instr)
         {
             IRBuilder<> builder(&*Instr);
 
-            auto rightOp = TryGetConstantInt(Instr->getOperand(1));
+            Value *dividend = Instr->getOperand(0);
+            bool isSigned = Instr->getOpcode() == Instruction::SRem;
+            bool isNonNegative = isSigned && isKnownNonNegative(dividend, *DL, 0, nullptr, Instr);
+            Type *type = Instr->getType();
+
+            // Non-uniform vector of powers of two, every lane gets its own mask
+            if (getPerLaneShiftAmounts(Instr->getOperand(1), isSigned)) {
+                if ((!isSigned || isNonNegative) && hasCheapPerLaneOperation(Instr, Instruction::And)) {
+                    Value *mask = builder.CreateSub(Instr->getOperand(1), ConstantInt::get(type, 1));
+                    Value *newInst = builder.CreateAnd(dividend, mask);
+                    replaceInstruction(Instr, newInst, Instr->getOperand(1), NumRemToAnd, "RemToAnd", "a mask");
+                } else {
+                    reportMissed(Instr, "PerLaneMask", "signed remainder needs a rounding bias in every lane");
+                }
+                return;
+            }
+
+            const APInt *divisor = TryGetConstantAPInt(Instr->getOperand(1));
+            if (!divisor) {
+                if (!reduceByVariablePowerOf2(Instr, isNonNegative) && ReduceInvariantDivisors) {
+                    reduceByLoopInvariant(Instr, isNonNegative);
+                }
+                return;
+            }
+            if (divisor->isZero()) {
+                return;
+            }
+
+            if (isNonNegative && !divisor->isNegative()) {
+                isSigned = false;
+            }
+
+            // x % -d == x % d for signed modulo
+            APInt absDivisor = isSigned ? divisor->abs() : *divisor;
 
-            if (rightOp) {
-                if (isPowerOfTwo(*rightOp)) {
-                    int64_t powOfTwo = findPowerOfTwo(*rightOp);
-                    Value *mask = builder.getInt32((1 << powOfTwo) - 1);
-                    Value *newInst = builder.CreateAnd(Instr->getOperand(0), mask);
-                    Instr->replaceAllUsesWith(newInst);
-                    InstructionsToRemove.push_back(Instr);
+            if (absDivisor.isPowerOf2() && !(isSigned && absDivisor.isNegative())) {
+                unsigned powOfTwo = absDivisor.logBase2();
+                unsigned bitWidth = absDivisor.getBitWidth();
+                APInt mask = APInt::getLowBitsSet(bitWidth, powOfTwo);
+                Value *newInst;
+
+                if (!isSigned || isNonNegative) {
+                    newInst = builder.CreateAnd(dividend, ConstantInt::get(type, mask));
+                } else if (powOfTwo == 0) {
+                    newInst = ConstantInt::get(type, 0);
+                } else if (!isHot(Instr)) {
+                    return;
+                } else {
+                    Value *sign = builder.CreateAShr(dividend, powOfTwo - 1);
+                    Value *bias = builder.CreateLShr(sign, bitWidth - powOfTwo);
+                    Value *biased = builder.CreateAdd(dividend, bias, "", false, true);
+                    Value *rounded = builder.CreateAnd(biased, ConstantInt::get(type, ~mask));
+                    newInst = builder.CreateSub(dividend, rounded, "", false, true);
                 }
+                replaceInstruction(Instr, newInst, Instr->getOperand(1), NumRemToAnd, "RemToAnd", "a mask");
+                return;
+            }
+
+            // x % d == x - (x / d) * d, where the division is done with the magic number
+            if (!isHot(Instr)) {
+                return;
             }
+
+            Value *quotient = createDivByConstant(builder, dividend, Instr->getOperand(1), isSigned);
+            if (!quotient) {
+                reportMissed(Instr, "UnsupportedType", "remainder by a constant is only reduced for 8 to 64 bit integers");
+                return;
+            }
+
+            // |(x / d) * d| <= |x|, so none of these can wrap
+            Value *product = builder.CreateMul(quotient, Instr->getOperand(1), "", !isSigned, isSigned);
+            Value *newInst = builder.CreateSub(dividend, product, "", !isSigned, isSigned);
+            replaceInstruction(Instr, newInst, Instr->getOperand(1), NumRemToMagic, "RemToMagic",
+                               "a multiplication by a magic number");
+
+            // The multiplication by d may be cheaper as shifts and adds
+            addToWorklist(product);
+        }
+
+        /*
+         * Divisors that aren't constants but are always powers of two, like capacities of
+         * hash tables and ring buffers or alignments (1 << k, or a value that was checked with
+         * assert((d & (d - 1)) == 0) before the division):
+         *     x / d  ->  x >> cttz(d)       (x >> k for d = 1 << k)
+         *     x % d  ->  x & (d - 1)
+         * Division by zero is undefined, so d may be zero too. Signed division and modulo
+         * use the same bias as for constants, sign & (d - 1), which is wrong for
+         * d == INT_MIN, so d has to be known to be non-negative (or x, then it's unsigned).
+         */
+        bool reduceByVariablePowerOf2(Instruction *Instr, bool isNonNegative)
+        {
+            Value *divisor = Instr->getOperand(1);
+            if (isa<Constant>(divisor) || !isKnownPowerOf2OrZero(divisor, Instr)) {
+                return false;
+            }
+
+            unsigned opcode = Instr->getOpcode();
+            bool isDivision = opcode == Instruction::UDiv || opcode == Instruction::SDiv;
+            bool isSigned = (opcode == Instruction::SDiv || opcode == Instruction::SRem) && !isNonNegative;
+            // 1 << k without signed overflow can't be INT_MIN
+            bool isNonNegativeDivisor = match(divisor, m_NSWShl(m_One(), m_Value())) ||
+                                        isKnownNonNegative(divisor, *DL, 0, nullptr, Instr, DT);
+            if (isSigned && !isNonNegativeDivisor) {
+                reportMissed(Instr, "VariableSignBit", "the divisor is a power of 2, but it may be INT_MIN");
+                return true;
+            }
+
+            // The bias is three more instructions, a cold block keeps the division
+            bool needsBias = isSigned && !(isDivision && Instr->isExact());
+            if (needsBias && !isHot(Instr)) {
+                return true;
+            }
+
+            IRBuilder<> builder(Instr);
+            Value *dividend = Instr->getOperand(0);
+            Type *type = Instr->getType();
+
+            Value *biased = nullptr;
+            if (needsBias) {
+                Value *sign = builder.CreateAShr(dividend, type->getScalarSizeInBits() - 1);
+                Value *bias = builder.CreateAnd(sign, builder.CreateAdd(divisor, Constant::getAllOnesValue(type)));
+                biased = builder.CreateAdd(dividend, bias, "", false, true);
+            }
+
+            if (isDivision) {
+                Value *shift;
+                if (!match(divisor, m_Shl(m_One(), m_Value(shift)))) {
+                    shift = builder.CreateBinaryIntrinsic(Intrinsic::cttz, divisor, builder.getTrue());
+                }
+
+                Value *newInst;
+                if (!isSigned) {
+                    newInst = builder.CreateLShr(dividend, shift, "", Instr->isExact());
+                } else if (Instr->isExact()) {
+                    newInst = builder.CreateAShr(dividend, shift, "", true);
+                } else {
+                    newInst = builder.CreateAShr(biased, shift);
+                }
+                replaceInstruction(Instr, newInst, divisor, NumDivToShr, "DivToShr", "a shift");
+                return true;
+            }
+
+            Value *newInst;
+            if (!isSigned) {
+                newInst = builder.CreateAnd(dividend, builder.CreateAdd(divisor, Constant::getAllOnesValue(type)));
+            } else {
+                Value *rounded = builder.CreateAnd(biased, builder.CreateNeg(divisor));
+                newInst = builder.CreateSub(dividend, rounded, "", false, true);
+            }
+            replaceInstruction(Instr, newInst, divisor, NumRemToAnd, "RemToAnd", "a mask");
+            return true;
+        }
+
+        /*
+         * Division by a value that doesn't change in the loop (x / width, x % width) gets
+         * a magic number too, it is just calculated at run time, once in the preheader.
+         * Unlike for constants, the same instructions have to work for every d, so we use
+         * the round-up variant (Granlund-Montgomery, figure 4.1):
+         *     l  = ceil(log2(d))
+         *     m  = 2^N * (2^l - d) / d + 1                  ; N bits, calculated in 2N bits
+         *     q  = mulhi(x, m)
+         *     x / d = (q + ((x - q) >> min(l, 1))) >> max(l - 1, 0)
+         * For d == 1 and powers of two m is 1, q is 0 and the shifts alone give the exact
+         * quotient, so the loop needs no branch for them.
+         * Only unsigned (or non-negative) values, the signed variant needs more fixups
+         * than it saves.
+         */
+        void reduceByLoopInvariant(Instruction *Instr, bool isNonNegative)
+        {
+            Value *divisor = Instr->getOperand(1);
+            Loop *loop = LI->getLoopFor(Instr->getParent());
+            if (!loop || isa<Constant>(divisor) || !loop->isLoopInvariant(divisor)) {
+                return;
+            }
+
+            // We need a 2N-bit multiplication for the high half, i128 is as far as we go
+            Type *type = Instr->getType();
+            if (!type->isIntegerTy() || type->getIntegerBitWidth() < 8 || type->getIntegerBitWidth() > 64) {
+                return;
+            }
+
+            unsigned opcode = Instr->getOpcode();
+            bool isSigned = opcode == Instruction::SDiv || opcode == Instruction::SRem;
+            if (isSigned && !(isNonNegative && isKnownNonNegative(divisor, *DL, 0, nullptr, Instr, DT))) {
+                reportMissed(Instr, "InvariantSigned", "the divisor doesn't change in the loop, but the values may be negative");
+                return;
+            }
+
+            if (!isHot(Instr)) {
+                return;
+            }
+
+            while (loop->getParentLoop() && loop->getParentLoop()->isLoopInvariant(divisor) &&
+                   loop->getParentLoop()->getLoopPreheader()) {
+                loop = loop->getParentLoop();
+            }
+
+            BasicBlock *preheader = loop->getLoopPreheader();
+            if (!preheader) {
+                return;
+            }
+
+            RuntimeMagic &magic = RuntimeMagics[std::make_pair(divisor, loop)];
+            if (!magic.multiplier) {
+                IRBuilder<> preheaderBuilder(preheader->getTerminator());
+                magic = createRuntimeMagic(preheaderBuilder, divisor);
+            }
+
+            IRBuilder<> builder(Instr);
+            Value *dividend = Instr->getOperand(0);
+            Value *high = createMulHigh(builder, dividend, magic.multiplier, false);
+            Value *diff = builder.CreateLShr(builder.CreateSub(dividend, high), magic.shift1);
+            Value *quotient = builder.CreateLShr(builder.CreateAdd(diff, high), magic.shift2);
+
+            if (opcode == Instruction::UDiv || opcode == Instruction::SDiv) {
+                replaceInstruction(Instr, quotient, divisor, NumDivByInvariant, "DivByInvariant",
+                                   "a multiplication by a magic number calculated before the loop");
+                return;
+            }
+
+            // (x / d) * d <= x, so none of these can wrap
+            Value *product = builder.CreateMul(quotient, divisor, "", true, false);
+            Value *newInst = builder.CreateSub(dividend, product, "", true, false);
+            replaceInstruction(Instr, newInst, divisor, NumRemByInvariant, "RemByInvariant",
+                               "a multiplication by a magic number calculated before the loop");
+        }
+
+        /*
+         * The preheader runs even when the division in the loop doesn't (it may be behind
+         * a check for d != 0), so the division calculating m must not trap: it divides
+         * by a frozen d that is at least 1, the result for 0 isn't used anyway.
+         */
+        RuntimeMagic createRuntimeMagic(IRBuilder<> &builder, Value *divisor)
+        {
+            Type *type = divisor->getType();
+            Type *wideType = type->getExtendedType();
+            unsigned bitWidth = type->getIntegerBitWidth();
+
+            Value *safeDivisor = builder.CreateBinaryIntrinsic(Intrinsic::umax, builder.CreateFreeze(divisor),
+                                                               ConstantInt::get(type, 1));
+
+            // ctlz(0) is N, so l is 0 for d == 1
+            Value *minusOne = builder.CreateSub(safeDivisor, ConstantInt::get(type, 1));
+            Value *leadingZeros = builder.CreateBinaryIntrinsic(Intrinsic::ctlz, minusOne, builder.getFalse());
+            Value *log2 = builder.CreateSub(ConstantInt::get(type, bitWidth), leadingZeros, "matf.log2");
+
+            // 2^l - d < d, so m fits in N bits
+            Value *wideDivisor = builder.CreateZExt(safeDivisor, wideType);
+            Value *power = builder.CreateShl(ConstantInt::get(wideType, 1), builder.CreateZExt(log2, wideType));
+            Value *numerator = builder.CreateShl(builder.CreateSub(power, wideDivisor), bitWidth);
+
+            // Kept in 2N bits, that's how the loop multiplies with it
+            RuntimeMagic magic;
+            magic.multiplier = builder.CreateAdd(builder.CreateUDiv(numerator, wideDivisor), ConstantInt::get(wideType, 1),
+                                                 "matf.magic");
+            magic.shift1 = builder.CreateBinaryIntrinsic(Intrinsic::umin, log2, ConstantInt::get(type, 1));
+            magic.shift2 = builder.CreateSub(log2, magic.shift1);
+            return magic;
+        }
+
+        // ValueTracking knows 1 << k and similar, assert() leaves a branch on (d & (d - 1)) == 0
+        bool isKnownPowerOf2OrZero(Value *value, Instruction *at)
+        {
+            if (isKnownToBeAPowerOfTwo(value, *DL, true, 0, nullptr, at, DT)) {
+                return true;
+            }
+
+            auto lowerBits = m_CombineOr(m_Add(m_Specific(value), m_AllOnes()), m_Sub(m_Specific(value), m_One()));
+            for (User *user : value->users()) {
+                if (!match(user, m_c_And(m_Specific(value), lowerBits))) {
+                    continue;
+                }
+
+                for (User *test : user->users()) {
+                    ICmpInst::Predicate predicate;
+                    if (!match(test, m_ICmp(predicate, m_Specific(user), m_Zero())) || !ICmpInst::isEquality(predicate)) {
+                        continue;
+                    }
+
+                    for (User *testUser : test->users()) {
+                        auto *branch = dyn_cast<BranchInst>(testUser);
+                        if (!branch || !branch->isConditional()) {
+                            continue;
+                        }
+
+                        BasicBlock *isPowerOf2 = branch->getSuccessor(predicate == ICmpInst::ICMP_EQ ? 0 : 1);
+                        if (DT->dominates(BasicBlockEdge(branch->getParent(), isPowerOf2), at->getParent())) {
+                            return true;
+                        }
+                    }
+                }
+            }
+
+            return false;
+        }
+
+        /*
+         * A shift or mask of a shift or mask by constants is folded into one shift and
+         * at most one mask. Chains like this are left by reducing divisions and
+         * multiplications one after the other:
+         *     (x >> 4) >> 3  ->  x >> 7
+         *     (x >> 7) << 7  ->  x & -128
+         *     (x << 2) >> 5  ->  (x >> 3) & 0x07ffffff
+         *     (x & c1) & c2  ->  x & (c1 & c2)
+         */
+        void foldShiftChain(Instruction *Instr)
+        {
+            auto *inner = dyn_cast<BinaryOperator>(Instr->getOperand(0));
+            const APInt *outerConstant = TryGetConstantAPInt(Instr->getOperand(1));
+            if (!inner || !outerConstant) {
+                return;
+            }
+
+            const APInt *innerConstant = TryGetConstantAPInt(inner->getOperand(1));
+            if (!innerConstant) {
+                return;
+            }
+
+            Value *x = inner->getOperand(0);
+            unsigned outerOpcode = Instr->getOpcode();
+            unsigned innerOpcode = inner->getOpcode();
+            unsigned bitWidth = outerConstant->getBitWidth();
+            IRBuilder<> builder(Instr);
+
+            if (outerOpcode == Instruction::And) {
+                Value *newInst = nullptr;
+                if (innerOpcode == Instruction::And) {
+                    newInst = builder.CreateAnd(x, *outerConstant & *innerConstant);
+                } else if (innerConstant->ult(bitWidth) && innerOpcode == Instruction::LShr &&
+                           APInt::getLowBitsSet(bitWidth, bitWidth - innerConstant->getZExtValue()).isSubsetOf(*outerConstant)) {
+                    // The mask keeps every bit the shift can leave
+                    newInst = inner;
+                } else if (innerConstant->ult(bitWidth) && innerOpcode == Instruction::Shl &&
+                           APInt::getHighBitsSet(bitWidth, bitWidth - innerConstant->getZExtValue()).isSubsetOf(*outerConstant)) {
+                    newInst = inner;
+                }
+
+                if (newInst) {
+                    replaceFoldedInstruction(Instr, inner, newInst, "a single mask");
+                }
+                return;
+            }
+
+            // Shifting by the bit width or more is poison, leave it alone
+            if (!Instr->isShift() || !inner->isShift() || outerConstant->uge(bitWidth) || innerConstant->uge(bitWidth)) {
+                return;
+            }
+
+            unsigned outerShift = outerConstant->getZExtValue();
+            unsigned innerShift = innerConstant->getZExtValue();
+            Type *type = Instr->getType();
+
+            if (outerOpcode == innerOpcode) {
+                unsigned shift = outerShift + innerShift;
+                Value *newInst;
+                if (shift >= bitWidth) {
+                    // Every bit is shifted out, only the sign is left of an ashr
+                    newInst = outerOpcode == Instruction::AShr ? builder.CreateAShr(x, bitWidth - 1)
+                                                                : Constant::getNullValue(type);
+                } else if (outerOpcode == Instruction::Shl) {
+                    newInst = builder.CreateShl(x, shift, "",
+                                                Instr->hasNoUnsignedWrap() && inner->hasNoUnsignedWrap(),
+                                                Instr->hasNoSignedWrap() && inner->hasNoSignedWrap());
+                } else {
+                    bool isExact = Instr->isExact() && inner->isExact();
+                    newInst = outerOpcode == Instruction::LShr ? builder.CreateLShr(x, shift, "", isExact)
+                                                                : builder.CreateAShr(x, shift, "", isExact);
+                }
+
+                replaceFoldedInstruction(Instr, inner, newInst, "a single shift");
+                return;
+            }
+
+            // A shift in the other direction turns into a mask. When the shifts are not
+            // by the same amount it's one instruction more, unless the inner one goes away.
+            if (outerShift != innerShift && !inner->hasOneUse()) {
+                return;
+            }
+
+            Value *shifted = x;
+            APInt mask;
+            if (outerOpcode == Instruction::Shl && (innerOpcode == Instruction::LShr || innerOpcode == Instruction::AShr)) {
+                // (x >> a) << b, the low b bits are cleared
+                if (outerShift > innerShift) {
+                    shifted = builder.CreateShl(x, outerShift - innerShift);
+                } else if (outerShift < innerShift) {
+                    shifted = innerOpcode == Instruction::LShr ? builder.CreateLShr(x, innerShift - outerShift)
+                                                               : builder.CreateAShr(x, innerShift - outerShift);
+                }
+                mask = APInt::getHighBitsSet(bitWidth, bitWidth - outerShift);
+            } else if (outerOpcode == Instruction::LShr && innerOpcode == Instruction::Shl) {
+                // (x << a) >>> b, the high b bits are cleared
+                if (outerShift > innerShift) {
+                    shifted = builder.CreateLShr(x, outerShift - innerShift);
+                } else if (outerShift < innerShift) {
+                    shifted = builder.CreateShl(x, innerShift - outerShift);
+                }
+                mask = APInt::getLowBitsSet(bitWidth, bitWidth - outerShift);
+            } else {
+                return;
+            }
+
+            addToWorklist(shifted);
+            replaceFoldedInstruction(Instr, inner, builder.CreateAnd(shifted, mask), "a shift and a mask");
+        }
+
+        void replaceFoldedInstruction(Instruction *Instr, Instruction *inner, Value *newInst, StringRef replacement)
+        {
+            replaceInstruction(Instr, newInst, Instr->getOperand(1), NumShiftsFolded, "FoldShifts", replacement);
+
+            // Nothing else needed the first shift (the replaced one is still there until the end)
+            bool isDead = llvm::all_of(inner->users(), [&](User *user) {
+                return RemovedInstructions.count(cast<Instruction>(user));
+            });
+            if (isDead) {
+                removeInstruction(inner);
+            }
+        }
+
+        /*
+         * Division by a constant d is replaced by a multiplication with a "magic number"
+         * M ~ 2^(N+s)/d, from which only the high half of the 2N-bit product is used,
+         * followed by a shift by s (Granlund-Montgomery, Hacker's Delight ch. 10).
+         *
+         * Returns nullptr if the division can't be reduced.
+         */
+        Value *createDivByConstant(IRBuilder<> &builder, Value *dividend, Value *divisor, bool isSigned)
+        {
+            const APInt *divisorValue = TryGetConstantAPInt(divisor);
+            if (!divisorValue || divisorValue->isZero()) {
+                return nullptr;
+            }
+
+            // We need a 2N-bit multiplication for the high half, i128 is as far as we go
+            unsigned bitWidth = divisorValue->getBitWidth();
+            if (bitWidth < 8 || bitWidth > 64) {
+                return nullptr;
+            }
+
+            if (isSigned) {
+                return createSDivByConstant(builder, dividend, *divisorValue);
+            }
+            return createUDivByConstant(builder, dividend, *divisorValue);
+        }
+
+        Value *createUDivByConstant(IRBuilder<> &builder, Value *dividend, const APInt &divisor)
+        {
+            if (divisor.isOne()) {
+                return dividend;
+            }
+
+            // The quotient can only be 0 or 1
+            if (divisor.isNegative()) {
+                Value *cmp = builder.CreateICmpUGE(dividend, ConstantInt::get(dividend->getType(), divisor));
+                return builder.CreateZExt(cmp, dividend->getType());
+            }
+
+            MagicUnsigned magic = computeMagicUnsigned(divisor);
+            Value *high = createMulHigh(builder, dividend, magic.multiplier, false);
+
+            if (!magic.isAdd) {
+                return builder.CreateLShr(high, magic.shift);
+            }
+
+            // The magic number needs N+1 bits, so the add is done without overflowing:
+            // q = (((x - t) >> 1) + t) >> (s - 1)
+            Value *diff = builder.CreateSub(dividend, high);
+            diff = builder.CreateLShr(diff, 1);
+            Value *sum = builder.CreateAdd(diff, high);
+            return builder.CreateLShr(sum, magic.shift - 1);
+        }
+
+        Value *createSDivByConstant(IRBuilder<> &builder, Value *dividend, const APInt &divisor)
+        {
+            unsigned bitWidth = divisor.getBitWidth();
+
+            if (divisor.isOne()) {
+                return dividend;
+            }
+
+            if (divisor.isAllOnes()) {
+                return builder.CreateNeg(dividend);
+            }
+
+            // Only INT_MIN itself gives a non-zero quotient
+            if (divisor.isMinSignedValue()) {
+                Value *cmp = builder.CreateICmpEQ(dividend, ConstantInt::get(dividend->getType(), divisor));
+                return builder.CreateZExt(cmp, dividend->getType());
+            }
+
+            MagicSigned magic = computeMagicSigned(divisor);
+            Value *quotient = createMulHigh(builder, dividend, magic.multiplier, true);
+
+            // Correct for the magic number having the "wrong" sign
+            if (divisor.isStrictlyPositive() && magic.multiplier.isNegative()) {
+                quotient = builder.CreateAdd(quotient, dividend);
+            } else if (divisor.isNegative() && magic.multiplier.isStrictlyPositive()) {
+                quotient = builder.CreateSub(quotient, dividend);
+            }
+
+            if (magic.shift > 0) {
+                quotient = builder.CreateAShr(quotient, magic.shift);
+            }
+
+            // Round towards zero: add one if the quotient is negative
+            Value *signBit = builder.CreateLShr(quotient, bitWidth - 1);
+            return builder.CreateAdd(quotient, signBit);
+        }
+
+        Value *createMulHigh(IRBuilder<> &builder, Value *x, const APInt &multiplier, bool isSigned)
+        {
+            return createMulHigh(builder, x, ConstantInt::get(x->getType(), multiplier), isSigned);
+        }
+
+        // Upper N bits of the 2N-bit product of x and the magic number (N or 2N bits)
+        Value *createMulHigh(IRBuilder<> &builder, Value *x, Value *multiplier, bool isSigned)
+        {
+            Type *type = x->getType();
+            Type *wideType = type->getExtendedType();
+
+            Value *wideX = isSigned ? builder.CreateSExt(x, wideType) : builder.CreateZExt(x, wideType);
+            Value *wideMultiplier = isSigned ? builder.CreateSExt(multiplier, wideType) : builder.CreateZExt(multiplier, wideType);
+
+            // The 2N-bit product of two N-bit values can't wrap
+            Value *product = builder.CreateMul(wideX, wideMultiplier, "", !isSigned, isSigned);
+            Value *high = builder.CreateLShr(product, type->getScalarSizeInBits());
+            return builder.CreateTrunc(high, type);
+        }
+
+        struct MagicUnsigned {
+            APInt multiplier;
+            unsigned shift;
+            bool isAdd;
+        };
+
+        struct MagicSigned {
+            APInt multiplier;
+            unsigned shift;
+        };
+
+        // Hacker's Delight, magicu2, for 1 < d < 2^(N-1)
+        MagicUnsigned computeMagicUnsigned(const APInt &d)
+        {
+            unsigned bitWidth = d.getBitWidth();
+            APInt allOnes = APInt::getAllOnes(bitWidth);
+            APInt signedMin = APInt::getSignedMinValue(bitWidth);
+            APInt signedMax = APInt::getSignedMaxValue(bitWidth);
+
+            MagicUnsigned magic;
+            magic.isAdd = false;
+
+            APInt nc = allOnes - (allOnes - d).urem(d);
+            unsigned p = bitWidth - 1;
+            APInt q1, r1, q2, r2, delta;
+            APInt::udivrem(signedMin, nc, q1, r1);
+            APInt::udivrem(signedMax, d, q2, r2);
+
+            do {
+                p++;
+                if (r1.uge(nc - r1)) {
+                    q1 = q1 + q1 + 1;
+                    r1 = r1 + r1 - nc;
+                } else {
+                    q1 = q1 + q1;
+                    r1 = r1 + r1;
+                }
+
+                if ((r2 + 1).uge(d - r2)) {
+                    if (q2.uge(signedMax)) {
+                        magic.isAdd = true;
+                    }
+                    q2 = q2 + q2 + 1;
+                    r2 = r2 + r2 + 1 - d;
+                } else {
+                    if (q2.uge(signedMin)) {
+                        magic.isAdd = true;
+                    }
+                    q2 = q2 + q2;
+                    r2 = r2 + r2 + 1;
+                }
+                delta = d - 1 - r2;
+            } while (p < bitWidth * 2 && (q1.ult(delta) || (q1 == delta && r1.isZero())));
+
+            magic.multiplier = q2 + 1;
+            magic.shift = p - bitWidth;
+            return magic;
+        }
+
+        // Hacker's Delight, magic, for 2 <= |d| < 2^(N-1)
+        MagicSigned computeMagicSigned(const APInt &d)
+        {
+            unsigned bitWidth = d.getBitWidth();
+            APInt signedMin = APInt::getSignedMinValue(bitWidth);
+
+            APInt ad = d.abs();
+            APInt t = signedMin + d.lshr(bitWidth - 1);
+            APInt anc = t - 1 - t.urem(ad);
+            unsigned p = bitWidth - 1;
+            APInt q1 = signedMin.udiv(anc);
+            APInt r1 = signedMin - q1 * anc;
+            APInt q2 = signedMin.udiv(ad);
+            APInt r2 = signedMin - q2 * ad;
+            APInt delta;
+
+            do {
+                p++;
+                q1 <<= 1;
+                r1 <<= 1;
+                if (r1.uge(anc)) {
+                    q1 += 1;
+                    r1 -= anc;
+                }
+                q2 <<= 1;
+                r2 <<= 1;
+                if (r2.uge(ad)) {
+                    q2 += 1;
+                    r2 -= ad;
+                }
+                delta = ad - r2;
+            } while (q1.ult(delta) || (q1 == delta && r1.isZero()));
+
+            MagicSigned magic;
+            magic.multiplier = q2 + 1;
+            if (d.isNegative()) {
+                magic.multiplier = -magic.multiplier;
+            }
+            magic.shift = p - bitWidth;
+            return magic;
         }
 
         bool isPowerOfTwo(int64_t n)
@@ -130,12 +1538,97 @@ namespace
 
         std::optional<int64_t> TryGetConstantInt(Value *Operand)
         {
-            if(isa<ConstantInt>(Operand)) {
-                return dyn_cast<ConstantInt>(Operand)->getSExtValue();
+            const APInt *constant = TryGetConstantAPInt(Operand);
+            if (constant && constant->getBitWidth() <= 64) {
+                return constant->getSExtValue();
             }
 
             return std::nullopt;
         }
+
+        // Scalar constant or a vector constant with the same value in every lane (splat)
+        const APInt *TryGetConstantAPInt(Value *Operand)
+        {
+            const APInt *constant = nullptr;
+            if (match(Operand, m_APInt(constant))) {
+                return constant;
+            }
+
+            return nullptr;
+        }
+
+        /*
+         * Shift amounts for a vector constant whose lanes are different powers of two:
+         *     <1, 2, 4, 8> -> <0, 1, 2, 3>
+         * Splats are handled as scalars, so nullptr is returned for them too.
+         */
+        Constant *getPerLaneShiftAmounts(Value *Operand, bool isSigned)
+        {
+            auto *constant = dyn_cast<Constant>(Operand);
+            auto *vectorType = dyn_cast<FixedVectorType>(Operand->getType());
+            if (!constant || !vectorType || TryGetConstantAPInt(Operand)) {
+                return nullptr;
+            }
+
+            SmallVector<Constant *, 8> shifts;
+            for (unsigned lane = 0; lane < vectorType->getNumElements(); lane++) {
+                auto *element = dyn_cast_or_null<ConstantInt>(constant->getAggregateElement(lane));
+                if (!element || !element->getValue().isPowerOf2() || (isSigned && element->isNegative())) {
+                    return nullptr;
+                }
+                shifts.push_back(ConstantInt::get(element->getType(), element->getValue().logBase2()));
+            }
+
+            return ConstantVector::get(shifts);
+        }
+
+        // Shifts by a different amount per lane are slow on some targets (x86 before AVX2)
+        bool hasCheapPerLaneOperation(Instruction *Instr, unsigned opcode)
+        {
+            TargetTransformInfo::TargetCostKind costKind = TargetTransformInfo::TCK_RecipThroughput;
+            InstructionCost newCost = TTI->getArithmeticInstrCost(opcode, Instr->getType(), costKind,
+                                                                  TargetTransformInfo::OK_AnyValue,
+                                                                  TargetTransformInfo::OK_NonUniformConstantValue);
+            InstructionCost oldCost = TTI->getArithmeticInstrCost(Instr->getOpcode(), Instr->getType(), costKind,
+                                                                  TargetTransformInfo::OK_AnyValue,
+                                                                  TargetTransformInfo::OK_NonUniformConstantValue);
+
+            return newCost.isValid() && oldCost.isValid() && newCost <= oldCost;
+        }
+    };
+
+    struct ArithmeticStrengthReductionPass : public FunctionPass
+    {
+        static char ID; // Pass identification, replacement for typeid
+        ArithmeticStrengthReductionPass() : FunctionPass(ID) {}
+
+        void getAnalysisUsage(AnalysisUsage &AU) const override
+        {
+            AU.setPreservesCFG();
+            AU.addRequired<TargetTransformInfoWrapperPass>();
+            AU.addRequired<TargetLibraryInfoWrapperPass>();
+            AU.addRequired<LoopInfoWrapperPass>();
+            AU.addRequired<DominatorTreeWrapperPass>();
+            AU.addRequired<OptimizationRemarkEmitterWrapperPass>();
+            AU.addRequired<ProfileSummaryInfoWrapperPass>();
+            LazyBlockFrequencyInfoPass::getLazyBFIAnalysisUsage(AU);
+        }
+
+        bool runOnFunction(Function &F) override
+        {
+            // Block frequencies are calculated only if they are needed
+            ProfileSummaryInfo *PSI = &getAnalysis<ProfileSummaryInfoWrapperPass>().getPSI();
+            BlockFrequencyInfo *BFI = PSI->hasProfileSummary() ? &getAnalysis<LazyBlockFrequencyInfoPass>().getBFI() : nullptr;
+
+            ArithmeticStrengthReduction reduction(&getAnalysis<TargetTransformInfoWrapperPass>().getTTI(F),
+                                                  &getAnalysis<TargetLibraryInfoWrapperPass>().getTLI(F),
+                                                  &F.getParent()->getDataLayout(),
+                                                  &getAnalysis<LoopInfoWrapperPass>().getLoopInfo(),
+                                                  &getAnalysis<DominatorTreeWrapperPass>().getDomTree(),
+                                                  &getAnalysis<OptimizationRemarkEmitterWrapperPass>().getORE(),
+                                                  PSI, BFI);
+            return reduction.reduceFunction(F);
+        }
     };
 }
 
@@ -0,0 +1,391 @@
+#include "FunctionCache.h"
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/AsmParser/Parser.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/IR/TypeFinder.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SHA1.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+#include <chrono>
+
+using namespace llvm;
+using namespace matf;
+
+// Comment lines with the order of the predecessors, at the end of the text of a function
+static const StringLiteral UseListOrderComment = "matf.uselistorder";
+
+namespace
+{
+    // Collects the globals a value uses, false if one of them can't be found by name in another module
+    bool collectGlobals(Value *value, SetVector<GlobalValue *> &globals, SmallPtrSetImpl<Constant *> &visited) {
+        if (auto *metadata = dyn_cast<MetadataAsValue>(value)) {
+            if (auto *constant = dyn_cast<ConstantAsMetadata>(metadata->getMetadata())) {
+                return collectGlobals(constant->getValue(), globals, visited);
+            }
+            return true;
+        }
+
+        auto *constant = dyn_cast<Constant>(value);
+        if (!constant || !visited.insert(constant).second) {
+            return true;
+        }
+
+        if (auto *global = dyn_cast<GlobalValue>(constant)) {
+            globals.insert(global);
+            return global->hasName() && (isa<Function>(global) || isa<GlobalVariable>(global));
+        }
+
+        if (isa<BlockAddress>(constant) || isa<DSOLocalEquivalent>(constant)) {
+            return false;
+        }
+
+        for (Value *operand : constant->operands()) {
+            if (!collectGlobals(operand, globals, visited)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Types of a cache entry to the types of the module, named structs are found up front
+    class EntryTypeMapper : public ValueMapTypeRemapper {
+    public:
+        DenseMap<Type *, Type *> mapped;
+
+        Type *remapType(Type *type) override {
+            auto found = mapped.find(type);
+            if (found != mapped.end()) {
+                return found->second;
+            }
+
+            SmallVector<Type *, 8> elements;
+            bool changed = false;
+            for (Type *element : type->subtypes()) {
+                elements.push_back(remapType(element));
+                changed |= elements.back() != element;
+            }
+
+            Type *result = type;
+            if (changed) {
+                if (auto *structType = dyn_cast<StructType>(type)) {
+                    result = StructType::get(type->getContext(), elements, structType->isPacked());
+                } else if (auto *arrayType = dyn_cast<ArrayType>(type)) {
+                    result = ArrayType::get(elements[0], arrayType->getNumElements());
+                } else if (auto *vectorType = dyn_cast<VectorType>(type)) {
+                    result = VectorType::get(elements[0], vectorType->getElementCount());
+                } else if (auto *pointerType = dyn_cast<PointerType>(type)) {
+                    result = PointerType::get(elements[0], pointerType->getAddressSpace());
+                } else if (auto *functionType = dyn_cast<FunctionType>(type)) {
+                    result = FunctionType::get(elements[0], makeArrayRef(elements).drop_front(),
+                                               functionType->isVarArg());
+                }
+            }
+            return mapped[type] = result;
+        }
+    };
+}
+
+FunctionCache::FunctionCache(StringRef directory, StringRef options) : directory(directory), options(options) {}
+
+std::string FunctionCache::getPath(StringRef key) const {
+    // pruneCache only looks at files with this prefix
+    SmallString<128> path(directory);
+    sys::path::append(path, "llvmcache-" + key);
+    return std::string(path.str());
+}
+
+std::string FunctionCache::getText(Function &F) {
+    if (F.getSubprogram() || F.hasPrefixData() || F.hasPrologueData()) {
+        return "";
+    }
+
+    // Globals in the order of their first use, so the text depends only on the function
+    SetVector<GlobalValue *> globals;
+    SmallPtrSet<Constant *, 32> visited;
+    if (F.hasPersonalityFn() && !collectGlobals(F.getPersonalityFn(), globals, visited)) {
+        return "";
+    }
+    for (BasicBlock &BB : F) {
+        if (BB.hasAddressTaken()) {
+            return "";
+        }
+
+        for (Instruction &Instr : BB) {
+            for (Value *operand : Instr.operands()) {
+                if (!collectGlobals(operand, globals, visited)) {
+                    return "";
+                }
+            }
+        }
+    }
+
+    Module &M = *F.getParent();
+    Module extracted(F.getName(), F.getContext());
+    extracted.setDataLayout(M.getDataLayout());
+    extracted.setTargetTriple(M.getTargetTriple());
+    // Hot and cold code are reduced differently
+    for (StringRef summary : {"ProfileSummary", "CSProfileSummary"}) {
+        if (Metadata *flag = M.getModuleFlag(summary)) {
+            extracted.addModuleFlag(Module::Error, summary, flag);
+        }
+    }
+
+    // Declarations keep the attributes, TargetLibraryInfo and the passes look at them
+    ValueToValueMapTy map;
+    for (GlobalValue *global : globals) {
+        if (global == &F) {
+            continue;
+        }
+
+        if (auto *function = dyn_cast<Function>(global)) {
+            Function *declaration = Function::Create(function->getFunctionType(), GlobalValue::ExternalLinkage,
+                                                     function->getAddressSpace(), function->getName(), &extracted);
+            declaration->setCallingConv(function->getCallingConv());
+            declaration->setAttributes(function->getAttributes());
+            map[function] = declaration;
+        } else {
+            auto *variable = cast<GlobalVariable>(global);
+            map[variable] = new GlobalVariable(extracted, variable->getValueType(), variable->isConstant(),
+                                               GlobalValue::ExternalLinkage, nullptr, variable->getName(), nullptr,
+                                               variable->getThreadLocalMode(), variable->getAddressSpace());
+        }
+    }
+
+    Function *copy = Function::Create(F.getFunctionType(), GlobalValue::ExternalLinkage, F.getAddressSpace(),
+                                      F.getName(), &extracted);
+    map[&F] = copy;
+    for (auto arguments : zip(F.args(), copy->args())) {
+        std::get<1>(arguments).setName(std::get<0>(arguments).getName());
+        map[&std::get<0>(arguments)] = &std::get<1>(arguments);
+    }
+
+    SmallVector<ReturnInst *, 4> returns;
+    CloneFunctionInto(copy, &F, map, CloneFunctionChangeType::DifferentModule, returns);
+    // Added even when there is no debug info, the parser would strip it with a warning
+    if (NamedMDNode *units = extracted.getNamedMetadata("llvm.dbg.cu")) {
+        extracted.eraseNamedMetadata(units);
+    }
+
+    std::string text;
+    raw_string_ostream stream(text);
+    extracted.print(stream, nullptr, false);
+
+    /*
+     * Predecessors of a block are in the order of its uses, which the parser doesn't
+     * keep. The order of the function is written after it, one line per block
+     *     ; matf.uselistorder <block> <block of the branch>:<operand> ...
+     * and restoreUseListOrder sorts the uses back, so replayed functions print the
+     * same as the ones that were reduced. Uselistorder directives would do the same,
+     * but the printer looks at every use of the constants, which are shared by all
+     * the functions of the context.
+     */
+    DenseMap<const BasicBlock *, unsigned> numbers;
+    for (BasicBlock &BB : F) {
+        numbers[&BB] = numbers.size();
+    }
+    for (BasicBlock &BB : F) {
+        if (!BB.hasNUsesOrMore(2)) {
+            continue;
+        }
+
+        stream << "\n; " << UseListOrderComment << " " << numbers[&BB];
+        for (const Use &use : BB.uses()) {
+            stream << " " << numbers[cast<Instruction>(use.getUser())->getParent()] << ":" << use.getOperandNo();
+        }
+    }
+    stream << "\n";
+    return stream.str();
+}
+
+void FunctionCache::restoreUseListOrder(Function &F, StringRef text) {
+    std::vector<BasicBlock *> blocks;
+    DenseMap<const BasicBlock *, unsigned> numbers;
+    for (BasicBlock &BB : F) {
+        numbers[&BB] = blocks.size();
+        blocks.push_back(&BB);
+    }
+
+    std::string prefix = ("\n; " + UseListOrderComment + " ").str();
+    for (size_t found = text.find(prefix); found != StringRef::npos; found = text.find(prefix, found + 1)) {
+        SmallVector<StringRef, 8> fields;
+        text.substr(found + prefix.size()).split('\n').first.split(fields, ' ');
+
+        unsigned number;
+        if (fields[0].getAsInteger(10, number) || number >= blocks.size()) {
+            return;
+        }
+
+        DenseMap<std::pair<unsigned, unsigned>, unsigned> positions;
+        for (StringRef field : drop_begin(fields)) {
+            unsigned userNumber, operand;
+            std::pair<StringRef, StringRef> parts = field.split(':');
+            if (parts.first.getAsInteger(10, userNumber) || parts.second.getAsInteger(10, operand)) {
+                return;
+            }
+            positions[std::make_pair(userNumber, operand)] = positions.size();
+        }
+
+        auto position = [&](const Use &use) {
+            const BasicBlock *userBlock = cast<Instruction>(use.getUser())->getParent();
+            return positions.lookup(std::make_pair(numbers.lookup(userBlock), use.getOperandNo()));
+        };
+        blocks[number]->sortUseList([&](const Use &left, const Use &right) { return position(left) < position(right); });
+    }
+}
+
+std::string FunctionCache::getKey(Function &F, std::string &text) const {
+    text = getText(F);
+    if (text.empty()) {
+        return "";
+    }
+
+    SHA1 hash;
+    hash.update(options);
+    hash.update(StringRef("\0", 1));
+    hash.update(text);
+    return toHex(hash.final(), true);
+}
+
+Optional<std::string> FunctionCache::load(StringRef key) const {
+    std::string path = getPath(key);
+    Expected<sys::fs::file_t> file = sys::fs::openNativeFileForRead(path);
+    if (!file) {
+        consumeError(file.takeError());
+        return None;
+    }
+
+    ErrorOr<std::unique_ptr<MemoryBuffer>> buffer = MemoryBuffer::getOpenFile(*file, path, -1, false);
+    if (buffer) {
+        // Pruning deletes the least recently used entries first
+        sys::fs::setLastAccessAndModificationTime(*file, std::chrono::system_clock::now());
+    }
+    sys::fs::closeFile(*file);
+
+    if (!buffer) {
+        return None;
+    }
+    return (*buffer)->getBuffer().str();
+}
+
+void FunctionCache::store(StringRef key, StringRef entry) const {
+    // Renaming is atomic, a reader sees the whole entry or none. Two processes storing the
+    // same key store the same entry, so it doesn't matter which one renames last.
+    Expected<sys::fs::TempFile> temp = sys::fs::TempFile::create(getPath("%%%%%%%%.tmp"));
+    if (!temp) {
+        consumeError(temp.takeError());
+        return;
+    }
+
+    raw_fd_ostream stream(temp->FD, false);
+    stream << entry;
+    stream.flush();
+    if (stream.has_error()) {
+        stream.clear_error();
+        consumeError(temp->discard());
+        return;
+    }
+
+    consumeError(temp->keep(getPath(key)));
+}
+
+bool FunctionCache::prune(const CachePruningPolicy &policy) const {
+    return pruneCache(directory, policy);
+}
+
+bool FunctionReplayer::replay(Function &F, StringRef entry) {
+    SMDiagnostic diagnostic;
+    std::unique_ptr<Module> cached = parseAssemblyString(entry, diagnostic, M.getContext());
+    Function *cachedF = cached ? cached->getFunction(F.getName()) : nullptr;
+    if (!cachedF || cachedF->isDeclaration()) {
+        return false;
+    }
+
+    if (!structTypesFound) {
+        TypeFinder finder;
+        finder.run(M, true);
+        for (StructType *type : finder) {
+            structTypes[type->getName()] = type;
+        }
+        structTypesFound = true;
+    }
+
+    // The module has %struct.a, so the parser named the one from the entry %struct.a.N
+    EntryTypeMapper types;
+    TypeFinder cachedTypes;
+    cachedTypes.run(*cached, false);
+    for (StructType *type : cachedTypes) {
+        StringRef name, suffix;
+        std::tie(name, suffix) = type->getName().rsplit('.');
+        StructType *moduleType = structTypes.lookup(name);
+        if (suffix.empty() || !all_of(suffix, isDigit) || !moduleType) {
+            return false;
+        }
+        types.mapped[type] = moduleType;
+    }
+
+    if (types.remapType(cachedF->getFunctionType()) != F.getFunctionType()) {
+        return false;
+    }
+
+    ValueToValueMapTy map;
+    map[cachedF] = &F;
+    for (GlobalValue &global : cached->global_values()) {
+        if (&global == cachedF) {
+            continue;
+        }
+
+        if (GlobalValue *moduleGlobal = M.getNamedValue(global.getName())) {
+            if (moduleGlobal->getValueType() != types.remapType(global.getValueType())) {
+                return false;
+            }
+            map[&global] = moduleGlobal;
+        } else if (!isa<Function>(global)) {
+            // Only declarations of intrinsics and library functions the passes created can be new
+            return false;
+        }
+    }
+
+    for (Function &function : cached->functions()) {
+        if (&function == cachedF || map.count(&function)) {
+            continue;
+        }
+
+        Function *declaration =
+            Function::Create(cast<FunctionType>(types.remapType(function.getFunctionType())),
+                             GlobalValue::ExternalLinkage, function.getAddressSpace(), function.getName(), &M);
+        declaration->setCallingConv(function.getCallingConv());
+        declaration->setAttributes(function.getAttributes());
+        map[&function] = declaration;
+    }
+
+    // The old body is deleted and the cached one moved in its place
+    for (BasicBlock &BB : F) {
+        BB.dropAllReferences();
+    }
+    while (!F.empty()) {
+        F.begin()->eraseFromParent();
+    }
+
+    F.getBasicBlockList().splice(F.end(), cachedF->getBasicBlockList());
+    for (auto arguments : zip(cachedF->args(), F.args())) {
+        map[&std::get<0>(arguments)] = &std::get<1>(arguments);
+    }
+    for (Instruction &Instr : instructions(F)) {
+        RemapInstruction(&Instr, map, RF_IgnoreMissingLocals, &types);
+    }
+    FunctionCache::restoreUseListOrder(F, entry);
+
+    return true;
+}
@@ -0,0 +1,88 @@
+#ifndef MATF_STRENGTH_REDUCTION_FUNCTION_CACHE_H
+#define MATF_STRENGTH_REDUCTION_FUNCTION_CACHE_H
+
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CachePruning.h"
+#include <memory>
+#include <string>
+
+/*
+ * On-disk cache of reduced functions, used by matf-sr -cache-dir:
+ *
+ *     cache-dir/llvmcache-<sha1 of the options and the function>
+ *
+ * The key of a function is the hash of its text together with the declarations
+ * of the globals it uses, the data layout, the target and the profile summary of
+ * the module, so it doesn't change when other functions of the module change.
+ * An entry is empty when the passes didn't change the function, otherwise it
+ * holds the reduced function in the same form, and its body replaces the body
+ * of the function without running any analysis.
+ *
+ * Entries are written to a temporary file that is renamed, so several matf-sr
+ * processes can share the directory. Reading an entry updates its access time,
+ * and pruning deletes the least recently used ones first (the same pruning as
+ * the ThinLTO cache, -cache-policy takes its format).
+ */
+
+namespace matf
+{
+    class FunctionCache {
+    public:
+        // Options are a part of every key, everything that changes the result of the passes has to be in them
+        FunctionCache(llvm::StringRef directory, llvm::StringRef options);
+
+        llvm::StringRef getDirectory() const { return directory; }
+
+        /*
+         * The key of F and the text it was computed from. The key is empty when F
+         * can't be cached: it has debug info (metadata of the compile unit can't be
+         * shared between modules), its blocks have their address taken, or it uses
+         * globals without a name, aliases or ifuncs.
+         */
+        std::string getKey(llvm::Function &F, std::string &text) const;
+
+        // The text the key of F would be computed from now, empty if F can't be cached
+        static std::string getText(llvm::Function &F);
+
+        // Puts the predecessors of the blocks of F, parsed from text, in the order getText wrote down
+        static void restoreUseListOrder(llvm::Function &F, llvm::StringRef text);
+
+        llvm::Optional<std::string> load(llvm::StringRef key) const;
+
+        // Errors are ignored, the function is reduced again the next time
+        void store(llvm::StringRef key, llvm::StringRef entry) const;
+
+        bool prune(const llvm::CachePruningPolicy &policy) const;
+
+    private:
+        std::string directory;
+        std::string options;
+
+        std::string getPath(llvm::StringRef key) const;
+    };
+
+    /*
+     * Replaces bodies of functions of one module with the ones from cache entries.
+     * Entries are parsed into the context of the module, where their named structs
+     * get a new name if the module already has them (%struct.a becomes %struct.a.3),
+     * so types are mapped back to the ones of the module by name.
+     */
+    class FunctionReplayer {
+    public:
+        explicit FunctionReplayer(llvm::Module &M) : M(M) {}
+
+        // False if the entry doesn't fit the module, F is not changed then
+        bool replay(llvm::Function &F, llvm::StringRef entry);
+
+    private:
+        llvm::Module &M;
+        llvm::StringMap<llvm::StructType *> structTypes;
+        bool structTypesFound = false;
+    };
+}
+
+#endif
@@ -0,0 +1,515 @@
+#include "FunctionCache.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/AsmParser/Parser.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/InitializePasses.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Pass.h"
+#include "llvm/PassInfo.h"
+#include "llvm/PassRegistry.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Transforms/Utils.h"
+#include <chrono>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+ * Runs the strength reduction passes on many modules at the same time:
+ *
+ *     matf-sr -mem2reg -j 8 -o out/ a.ll b.bc c.ll
+ *
+ * Every module gets its own LLVMContext and pass manager on one of the threads
+ * of the pool, so modules are reduced in parallel. Functions of one module share
+ * the context, which is not thread safe. When there are fewer modules than threads,
+ * the functions of big modules (-split-instructions) are extracted in the same form
+ * as for the cache (FunctionCache.h) and reduced in contexts of their own on a second
+ * pool, so a single huge module is reduced in parallel too. Their reduced bodies are
+ * put back in the order of the module.
+ *
+ * Outputs are written to the output directory under the name of the input, as
+ * bitcode if the input was bitcode, and the timing report is printed in the
+ * order of the inputs, so the results don't depend on the number of threads.
+ *
+ * With -cache-dir, functions that were reduced by an earlier run with the same
+ * options are taken from the cache (FunctionCache.h) instead of being reduced
+ * again, and the report has the number of cache hits and misses of every file.
+ */
+
+using namespace llvm;
+
+static cl::list<std::string> InputFiles(cl::Positional, cl::OneOrMore, cl::desc("<input .ll/.bc files>"));
+
+static cl::opt<std::string> OutputDirectory("o", cl::Required, cl::value_desc("directory"),
+                                            cl::desc("Directory for the reduced modules"));
+
+static cl::opt<unsigned> Threads("j", cl::init(0), cl::value_desc("N"),
+                                 cl::desc("Number of threads (default: all hardware threads)"));
+
+static cl::opt<bool> RunMem2Reg("mem2reg", cl::init(false),
+                                cl::desc("Run mem2reg first, like `opt -mem2reg` does for clang -O0 output"));
+
+static cl::opt<bool> RunArithmetic("arit", cl::init(true), cl::desc("Run matf-arit-sr"));
+
+static cl::opt<bool> RunIndVars("iv", cl::init(true), cl::desc("Run matf-iv-sr"));
+
+static cl::opt<bool> VerifyOutput("verify", cl::init(true), cl::desc("Verify the reduced modules"));
+
+static cl::opt<std::string> CacheDirectory("cache-dir", cl::value_desc("directory"),
+                                           cl::desc("Reuse functions reduced by earlier runs from this directory"));
+
+static cl::opt<std::string> CachePolicy(
+    "cache-policy", cl::init("cache_size_bytes=1g"), cl::value_desc("policy"),
+    cl::desc("Size limit and pruning interval of the cache, in the format of the ThinLTO cache "
+             "policy (prune_interval=20m:cache_size_bytes=1g:prune_after=168h)"));
+
+static cl::opt<unsigned> SplitInstructions(
+    "split-instructions", cl::init(20000), cl::value_desc("N"),
+    cl::desc("Reduce the functions of modules with at least N instructions on several threads, "
+             "when there are fewer inputs than threads (0 turns it off)"));
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    struct FileResult {
+        std::string error;
+        unsigned functions = 0;
+        double parseSeconds = 0;
+        double reduceSeconds = 0;
+        double writeSeconds = 0;
+        unsigned cacheHits = 0;
+        // Functions that can't be cached are misses too
+        unsigned cacheMisses = 0;
+    };
+
+    double secondsSince(Clock::time_point start) {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    // Passes are found by the name they are registered with, the same way opt does it
+    void addPass(legacy::PassManagerBase &passManager, StringRef name) {
+        const PassInfo *info = PassRegistry::getPassRegistry()->getPassInfo(name);
+        passManager.add(info->createPass());
+    }
+
+    // Real target costs when the target of the module is built in, default ones otherwise
+    std::unique_ptr<TargetMachine> createTargetMachine(Module &module) {
+        std::string error;
+        Triple triple(module.getTargetTriple().empty() ? sys::getDefaultTargetTriple() : module.getTargetTriple());
+        const Target *target = TargetRegistry::lookupTarget(triple.str(), error);
+        if (!target) {
+            return nullptr;
+        }
+
+        return std::unique_ptr<TargetMachine>(
+            target->createTargetMachine(triple.str(), "", "", TargetOptions(), None));
+    }
+
+    // The pipeline of the command line, initialized for the functions of the module
+    std::unique_ptr<legacy::FunctionPassManager> createPassManager(Module &module, TargetMachine *targetMachine) {
+        Triple triple(module.getTargetTriple());
+        auto passManager = std::make_unique<legacy::FunctionPassManager>(&module);
+        passManager->add(new TargetLibraryInfoWrapperPass(triple));
+        passManager->add(createTargetTransformInfoWrapperPass(
+            targetMachine ? targetMachine->getTargetIRAnalysis() : TargetIRAnalysis()));
+
+        if (RunMem2Reg) {
+            passManager->add(createPromoteMemoryToRegisterPass());
+        }
+        if (RunIndVars) {
+            addPass(*passManager, "matf-iv-sr");
+        }
+        if (RunArithmetic) {
+            addPass(*passManager, "matf-arit-sr");
+        }
+
+        passManager->doInitialization();
+        return passManager;
+    }
+
+    // A function of the module, with its cache entry and the chunk of the function pool it's reduced in
+    struct ExtractedFunction {
+        Function *F;
+        std::string key;
+        // As it's extracted for the cache, empty if it can't be
+        std::string text;
+        Optional<std::string> entry;
+        size_t chunk = 0;
+        size_t position = 0;
+    };
+
+    /*
+     * Reduces extracted functions (FunctionCache::getText) in a context of their own,
+     * so it runs on another thread than their module. They are linked into one module,
+     * which gets one pass manager. The result of each function is its text after the
+     * passes, empty if they didn't change it, and None if it couldn't be parsed or
+     * linked, then it's reduced in its module.
+     */
+    std::vector<Optional<std::string>> reduceExtracted(ArrayRef<const ExtractedFunction *> functions) {
+        LLVMContext context;
+        std::vector<Optional<std::string>> results(functions.size());
+
+        std::unique_ptr<Module> linked;
+        std::vector<std::string> names(functions.size());
+        for (size_t i = 0; i < functions.size(); i++) {
+            SMDiagnostic diagnostic;
+            std::unique_ptr<Module> module = parseAssemblyString(functions[i]->text, diagnostic, context);
+            if (!module) {
+                continue;
+            }
+
+            // The other functions of the text are declarations
+            auto defined = find_if(*module, [](Function &F) { return !F.isDeclaration(); });
+            if (defined == module->end() || !defined->hasName()) {
+                continue;
+            }
+            names[i] = defined->getName().str();
+
+            if (!linked) {
+                linked = std::move(module);
+            } else if (Linker::linkModules(*linked, std::move(module))) {
+                return std::vector<Optional<std::string>>(functions.size());
+            }
+        }
+
+        if (!linked) {
+            return results;
+        }
+
+        // All of them are from the same module, so they have the same target
+        std::unique_ptr<TargetMachine> targetMachine = createTargetMachine(*linked);
+        std::unique_ptr<legacy::FunctionPassManager> passManager = createPassManager(*linked, targetMachine.get());
+        for (size_t i = 0; i < functions.size(); i++) {
+            Function *F = names[i].empty() ? nullptr : linked->getFunction(names[i]);
+            if (!F) {
+                continue;
+            }
+
+            // Parsing and linking change the order of the predecessors
+            matf::FunctionCache::restoreUseListOrder(*F, functions[i]->text);
+            bool changed = passManager->run(*F);
+
+            std::string reduced = changed ? matf::FunctionCache::getText(*F) : functions[i]->text;
+            results[i] = reduced == functions[i]->text ? "" : reduced;
+        }
+        passManager->doFinalization();
+
+        return results;
+    }
+
+    std::string outputPath(StringRef inputFile) {
+        SmallString<256> path(OutputDirectory);
+        sys::path::append(path, sys::path::filename(inputFile));
+        return std::string(path.str());
+    }
+
+    FileResult reduceFile(const std::string &inputFile, const matf::FunctionCache *cache, ThreadPool *functionPool) {
+        FileResult result;
+        Clock::time_point start = Clock::now();
+
+        // Large files are memory mapped
+        ErrorOr<std::unique_ptr<MemoryBuffer>> buffer = MemoryBuffer::getFile(inputFile);
+        if (!buffer) {
+            result.error = buffer.getError().message();
+            return result;
+        }
+
+        LLVMContext context;
+        SMDiagnostic diagnostic;
+        std::unique_ptr<Module> module = parseIR((*buffer)->getMemBufferRef(), diagnostic, context);
+        if (!module) {
+            raw_string_ostream errorStream(result.error);
+            diagnostic.print(inputFile.c_str(), errorStream, false);
+            return result;
+        }
+        result.parseSeconds = secondsSince(start);
+
+        start = Clock::now();
+        std::unique_ptr<TargetMachine> targetMachine = createTargetMachine(*module);
+
+        // Functions are reduced one by one, so the ones from the cache can be skipped
+        std::unique_ptr<legacy::FunctionPassManager> passManager = createPassManager(*module, targetMachine.get());
+        matf::FunctionReplayer replayer(*module);
+
+        // Extracting and replaying costs more than reducing small modules on one thread
+        size_t instructions = module->getInstructionCount();
+        if (instructions < SplitInstructions) {
+            functionPool = nullptr;
+        }
+
+        /*
+         * Nothing is changed in the first pass over the functions, their texts and
+         * cache entries are looked up and the extracted ones are cut into chunks of about
+         * the same size, a few per thread so a big function doesn't leave the other
+         * threads idle. A chunk goes to the function pool as soon as it's full. In the
+         * second pass the functions get the body from the cache or the pool, or are reduced
+         * here, in the order of the module, so declarations the passes add are in the same
+         * order as without the cache and the pool.
+         */
+        size_t chunkInstructions = functionPool ? instructions / (4 * functionPool->getThreadCount()) + 1 : 0;
+
+        std::vector<ExtractedFunction> functions;
+        // Chunks keep pointers to the functions
+        functions.reserve(module->size());
+        std::vector<const ExtractedFunction *> chunk;
+        size_t currentInstructions = 0;
+        std::vector<std::shared_future<std::vector<Optional<std::string>>>> chunks;
+        auto submitChunk = [&]() {
+            chunks.push_back(functionPool->async([chunk]() { return reduceExtracted(chunk); }));
+            chunk.clear();
+            currentInstructions = 0;
+        };
+
+        for (Function &F : *module) {
+            if (F.isDeclaration()) {
+                continue;
+            }
+            result.functions++;
+
+            functions.push_back({&F});
+            ExtractedFunction &function = functions.back();
+            if (cache) {
+                function.key = cache->getKey(F, function.text);
+                function.entry = function.key.empty() ? None : cache->load(function.key);
+            } else if (functionPool) {
+                function.text = matf::FunctionCache::getText(F);
+            }
+
+            if (functionPool && !function.entry && !function.text.empty()) {
+                function.chunk = chunks.size();
+                function.position = chunk.size();
+                chunk.push_back(&function);
+                currentInstructions += F.getInstructionCount();
+                if (currentInstructions >= chunkInstructions) {
+                    submitChunk();
+                }
+            }
+        }
+        if (!chunk.empty()) {
+            submitChunk();
+        }
+
+        for (ExtractedFunction &function : functions) {
+            Function &F = *function.F;
+            // An empty entry means that the passes didn't change the function
+            if (function.entry) {
+                if (function.entry->empty() || replayer.replay(F, *function.entry)) {
+                    result.cacheHits++;
+                    continue;
+                }
+            }
+            if (cache) {
+                result.cacheMisses++;
+            }
+
+            if (functionPool && !function.text.empty() && !function.entry) {
+                const Optional<std::string> &reduced = chunks[function.chunk].get()[function.position];
+                if (reduced && (reduced->empty() || replayer.replay(F, *reduced))) {
+                    if (!function.key.empty()) {
+                        cache->store(function.key, *reduced);
+                    }
+                    continue;
+                }
+            }
+
+            passManager->run(F);
+
+            if (!function.key.empty()) {
+                std::string reduced = matf::FunctionCache::getText(F);
+                if (!reduced.empty()) {
+                    cache->store(function.key, reduced == function.text ? "" : reduced);
+                }
+            }
+        }
+        passManager->doFinalization();
+
+        // Functions from the cache are verified too
+        if (VerifyOutput) {
+            raw_string_ostream errorStream(result.error);
+            if (verifyModule(*module, &errorStream)) {
+                errorStream << "the reduced module is broken";
+                return result;
+            }
+        }
+        result.reduceSeconds = secondsSince(start);
+
+        start = Clock::now();
+        std::error_code errorCode;
+        ToolOutputFile output(outputPath(inputFile), errorCode, sys::fs::OF_None);
+        if (errorCode) {
+            result.error = errorCode.message();
+            return result;
+        }
+
+        if (isBitcode(reinterpret_cast<const unsigned char *>((*buffer)->getBufferStart()),
+                      reinterpret_cast<const unsigned char *>((*buffer)->getBufferEnd()))) {
+            WriteBitcodeToFile(*module, output.os());
+        } else {
+            module->print(output.os(), nullptr);
+        }
+        output.keep();
+        result.writeSeconds = secondsSince(start);
+
+        return result;
+    }
+
+    /*
+     * Everything that changes the reduced functions is a part of the cache keys: the
+     * pipeline, the -matf-* options of the passes (with the value after them, if it
+     * wasn't given with =) and the matf-sr binary, whose passes change when it's rebuilt
+     * (its size and modification time are compared, like ccache does with compilers).
+     */
+    std::string getCacheOptions(int argc, char **argv) {
+        std::string options;
+        raw_string_ostream stream(options);
+        stream << LLVM_VERSION_STRING << " mem2reg=" << RunMem2Reg << " arit=" << RunArithmetic << " iv=" << RunIndVars;
+
+        std::string executable = sys::fs::getMainExecutable(argv[0], reinterpret_cast<void *>(&getCacheOptions));
+        sys::fs::file_status status;
+        if (!sys::fs::status(executable, status)) {
+            stream << " " << status.getSize() << " "
+                   << status.getLastModificationTime().time_since_epoch().count();
+        }
+
+        for (int i = 1; i < argc; i++) {
+            StringRef argument(argv[i]);
+            if (argument.ltrim('-').startswith("matf-")) {
+                stream << " " << argument;
+                if (!argument.contains('=') && i + 1 < argc) {
+                    stream << " " << argv[i + 1];
+                }
+            }
+        }
+        return stream.str();
+    }
+}
+
+int main(int argc, char **argv) {
+    InitLLVM initLLVM(argc, argv);
+
+    InitializeAllTargets();
+    InitializeAllTargetMCs();
+
+    PassRegistry &registry = *PassRegistry::getPassRegistry();
+    initializeCore(registry);
+    initializeAnalysis(registry);
+    initializeTransformUtils(registry);
+    initializeTarget(registry);
+
+    cl::ParseCommandLineOptions(argc, argv, "MATF strength reduction of many modules in parallel\n");
+
+    // Two inputs with the same name would overwrite each other's output
+    StringSet<> outputNames;
+    for (const std::string &inputFile : InputFiles) {
+        if (!outputNames.insert(sys::path::filename(inputFile)).second) {
+            errs() << argv[0] << ": more than one input is named " << sys::path::filename(inputFile) << "\n";
+            return 1;
+        }
+    }
+
+    if (std::error_code errorCode = sys::fs::create_directories(OutputDirectory)) {
+        errs() << argv[0] << ": can't create " << OutputDirectory << ": " << errorCode.message() << "\n";
+        return 1;
+    }
+
+    std::unique_ptr<matf::FunctionCache> cache;
+    CachePruningPolicy cachePolicy;
+    if (!CacheDirectory.empty()) {
+        Expected<CachePruningPolicy> policy = parseCachePruningPolicy(CachePolicy);
+        if (!policy) {
+            errs() << argv[0] << ": invalid -cache-policy: " << toString(policy.takeError()) << "\n";
+            return 1;
+        }
+        cachePolicy = *policy;
+
+        if (std::error_code errorCode = sys::fs::create_directories(CacheDirectory)) {
+            errs() << argv[0] << ": can't create " << CacheDirectory << ": " << errorCode.message() << "\n";
+            return 1;
+        }
+        cache = std::make_unique<matf::FunctionCache>(CacheDirectory, getCacheOptions(argc, argv));
+    }
+
+    // Every task writes only its own result, they're printed in the order of the inputs
+    std::vector<FileResult> results(InputFiles.size());
+    Clock::time_point start = Clock::now();
+    {
+        ThreadPool pool(hardware_concurrency(Threads));
+        /*
+         * Tasks of the file pool wait for the tasks of the function pool, which never wait
+         * themselves. Threads of the file pool that wait don't take CPU time, so both pools
+         * have as many threads as there are to use.
+         */
+        std::unique_ptr<ThreadPool> functionPool;
+        if (SplitInstructions && InputFiles.size() < pool.getThreadCount()) {
+            functionPool = std::make_unique<ThreadPool>(hardware_concurrency(Threads));
+        }
+
+        for (size_t i = 0; i < InputFiles.size(); i++) {
+            pool.async([&results, &cache, &functionPool, i]() {
+                results[i] = reduceFile(InputFiles[i], cache.get(), functionPool.get());
+            });
+        }
+        pool.wait();
+    }
+    double totalSeconds = secondsSince(start);
+
+    // Entries written by this run are the most recently used ones, they're pruned last
+    if (cache) {
+        cache->prune(cachePolicy);
+    }
+
+    bool failed = false;
+    double sumSeconds = 0;
+    unsigned cacheHits = 0, cacheMisses = 0;
+    errs() << "file                                     functions  parse [s] reduce [s]  write [s]"
+           << (cache ? "   hits  misses" : "") << "\n";
+    for (size_t i = 0; i < InputFiles.size(); i++) {
+        FileResult &result = results[i];
+        if (!result.error.empty()) {
+            errs() << InputFiles[i] << ": " << result.error << "\n";
+            failed = true;
+            continue;
+        }
+
+        errs() << format("%-40s %9u %10.3f %10.3f %10.3f", InputFiles[i].c_str(), result.functions,
+                         result.parseSeconds, result.reduceSeconds, result.writeSeconds);
+        if (cache) {
+            errs() << format(" %6u %7u", result.cacheHits, result.cacheMisses);
+        }
+        errs() << "\n";
+        cacheHits += result.cacheHits;
+        cacheMisses += result.cacheMisses;
+        sumSeconds += result.parseSeconds + result.reduceSeconds + result.writeSeconds;
+    }
+    errs() << format("%zu files in %.3fs (%.3fs of work)\n", InputFiles.size(), totalSeconds, sumSeconds);
+    if (cache) {
+        errs() << format("cache: %u hits, %u misses\n", cacheHits, cacheMisses);
+    }
+
+    return failed ? 1 : 0;
+}
@@ -1,3 +1,6 @@
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/Statistic.h"
 #include "llvm/IR/Function.h"
 #include "llvm/Pass.h"
@@ -5,316 +8,1636 @@
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Instruction.h"
 #include "llvm/IR/Operator.h"
+#include "llvm/IR/PatternMatch.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Analysis/LazyBlockFrequencyInfo.h"
 #include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/LoopIterator.h"
 #include "llvm/Analysis/LoopPass.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Analysis/ProfileSummaryInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
 #include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Transforms/Utils.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
-#include <map>
+#include "llvm/Transforms/Utils/Local.h"
+#include "llvm/Transforms/Utils/ScalarEvolutionExpander.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
 #include <unordered_map>
 
 
 using namespace llvm;
+using namespace llvm::PatternMatch;
 using namespace std;
 
-namespace
-{
-    struct IndVarsStrengthReductionPass : public FunctionPass {
-        static char ID; // Pass identification, replacement for typeid
-        IndVarsStrengthReductionPass() : FunctionPass(ID) {}
+#define DEBUG_TYPE "matf-iv-sr"
 
-        Value* preHeaderValue;
-        std::vector<Instruction *> InstructionsToRemove;
+STATISTIC(NumReducedInductionVars, "Number of induction variables replaced with a phi");
+STATISTIC(NumReducedAddresses, "Number of addresses replaced with a pointer phi");
+STATISTIC(NumPhisCreated, "Number of phis created");
+STATISTIC(NumExitTestsReplaced, "Number of loop exit tests replaced with a test of a new phi");
+STATISTIC(NumCountersDeleted, "Number of counters deleted because they were not needed anymore");
+STATISTIC(NumNotProfitable, "Number of induction variables not reduced because a new phi costs more");
+STATISTIC(NumModularCounters, "Number of remainders and quotients of an induction variable replaced with wrapping counters");
+STATISTIC(NumModularMasks, "Number of remainders and quotients of an induction variable by a power of 2 replaced with a mask or a shift");
+STATISTIC(NumColdLoops, "Number of loops not reduced because they are not hot");
+STATISTIC(NumPowToProduct, "Number of pow calls of an induction variable replaced with a running product");
+STATISTIC(NumMergedIncrements, "Number of counter increments on several backedge paths merged into one in the latch");
 
-        // required
-        void getAnalysisUsage(AnalysisUsage &AU) const override {
-            AU.setPreservesCFG();
-            AU.addRequired<LoopInfoWrapperPass>();
-            AU.addRequired<TargetLibraryInfoWrapperPass>();
-        }
+static cl::opt<bool> ReduceAddresses(
+    "matf-iv-sr-addresses", cl::init(true), cl::Hidden,
+    cl::desc("Replace getelementptr instructions whose index is an induction variable "
+             "with pointers that are increased in every iteration"));
 
-        bool IsConstantInt(Value *Instr) {
-            return isa<ConstantInt>(Instr);
-        }
+static cl::opt<unsigned> MaxPolynomialDegree(
+    "matf-iv-sr-max-degree", cl::init(3), cl::Hidden,
+    cl::desc("Highest degree of polynomial induction variables (i * i, i * (i + 1) / 2) "
+             "that are replaced with chains of adds (1 reduces only affine ones)"));
 
-        int GetConstantInt(Value *Operand) {
-            ConstantInt *Constant = dyn_cast<ConstantInt>(Operand);
-            return Constant->getSExtValue();
-        }
+static cl::opt<bool> UseCostModel(
+    "matf-iv-sr-cost-model", cl::init(true), cl::Hidden,
+    cl::desc("Create a new phi only if the instructions it saves cost more than its "
+             "increment and the register it occupies (otherwise reduce every candidate)"));
+
+static cl::opt<unsigned> MulCostScale(
+    "matf-iv-sr-mul-cost-scale", cl::init(2), cl::Hidden,
+    cl::desc("Multiply the target cost of a mul saved by a new phi by this factor "
+             "(a mul has more latency than its throughput cost shows)"));
+
+static cl::opt<bool> ReduceModular(
+    "matf-iv-sr-modular", cl::init(true), cl::Hidden,
+    cl::desc("Replace i % n and i / n of an induction variable i and a loop invariant n "
+             "with a counter that wraps around n and a counter of the wraps"));
+
+static cl::opt<unsigned> HotCutoff(
+    "matf-iv-sr-hot-cutoff", cl::init(990000), cl::Hidden,
+    cl::desc("With a profile, only loops whose header is among the hottest blocks making up "
+             "this many parts per million of the profile are reduced"));
+
+static cl::opt<unsigned> AvailableRegisters(
+    "matf-iv-sr-registers", cl::init(0), cl::Hidden,
+    cl::desc("Number of registers for values live across a loop (default: ask the target)"));
+
+namespace
+{
+    /*
+     * Everything that changes while a function is reduced is kept here, and a new
+     * one is made for every function. The pass itself has no state, so different
+     * functions can be reduced at the same time (see StrengthReductionDriver).
+     */
+    struct IndVarsStrengthReduction {
+        ScalarEvolution *SE;
+        LoopInfo *LI;
+        const TargetTransformInfo *TTI;
+        const TargetLibraryInfo *TLI;
+        const DataLayout *DL;
+        OptimizationRemarkEmitter *ORE;
+        ProfileSummaryInfo *PSI;
+        // Only when there is a profile
+        BlockFrequencyInfo *BFI;
+
+        IndVarsStrengthReduction(ScalarEvolution *SE, LoopInfo *LI, const TargetTransformInfo *TTI,
+                                 const TargetLibraryInfo *TLI, const DataLayout *DL, OptimizationRemarkEmitter *ORE,
+                                 ProfileSummaryInfo *PSI, BlockFrequencyInfo *BFI)
+            : SE(SE), LI(LI), TTI(TTI), TLI(TLI), DL(DL), ORE(ORE), PSI(PSI), BFI(BFI) {}
 
         void PrintBasicBlock(BasicBlock* BB, string msg) {
-            errs() << "\n---------" << msg << "----------\n";
+            dbgs() << "\n---------" << msg << "----------\n";
             for (auto &Instr : *BB) {
-                errs() << Instr << "\n";
+                dbgs() << Instr << "\n";
             }
-            errs() << "-----------------------------------\n";
+            dbgs() << "-----------------------------------\n";
         }
 
+        /*
+         * Every induction variable is described by ScalarEvolution as an affine
+         * recurrence {start,+,step}: it has the value `start` in the first iteration
+         * and grows by `step` in every next one.
+         *     i = 3, 5, 7, ...       -> {3,+,2}
+         *     j = 4 * i + 981        -> {993,+,8}
+         *     k = (long long)(2 * i) -> {6,+,4} (i64)
+         *     l = row * stride + col -> {col,+,stride} (row is the counter)
+         *     &a[3 * i + 1]          -> {a + 4,+,12} (int *, step in bytes)
+         *
+         * Polynomials of the counter are recurrences too, their step is another recurrence,
+         * their difference in two consecutive iterations:
+         *     m = i * i              -> {0,+,1,+,2} (m grows by {1,+,2}, 2 * i + 1)
+         *     t = i * (i + 1) / 2    -> {0,+,1,+,1}
+         */
         struct InductionVarInfo {
-            Value *parent = nullptr;
-            int additiveStep;
-            int multiplicativeStep;
+            Value *value;
+            const SCEVAddRecExpr *addRec;
             bool isPhi;
-            Value *preheaderValue;
+            // New phi that replaces the value inside the loop, if it is reduced
+            PHINode *phi = nullptr;
+        };
+
+        /*
+         * Induction variables of the loop that is being reduced, in the order they were
+         * found (not in the order of their addresses, so new phis are created in the same
+         * order in every run). Records are bump allocated and the whole table is emptied
+         * before the next loop, so it's never bigger than the largest loop.
+         */
+        struct InductionTable {
+            BumpPtrAllocator allocator;
+            SmallVector<InductionVarInfo *, 16> records;
+            // Header phis, the counters of the loop
+            SmallVector<InductionVarInfo *, 4> counters;
+            DenseMap<Value *, InductionVarInfo *> index;
+
+            void insert(Value *val, const SCEVAddRecExpr *addRec, bool isPhi) {
+                auto *info = new (allocator.Allocate<InductionVarInfo>()) InductionVarInfo{val, addRec, isPhi};
+                records.push_back(info);
+                if (isPhi) {
+                    counters.push_back(info);
+                }
+                index[val] = info;
+            }
+
+            bool contains(Value *val) const {
+                return index.count(val);
+            }
+
+            void clear() {
+                records.clear();
+                counters.clear();
+                index.clear();
+                allocator.Reset();
+            }
         };
 
-        map<Value*, InductionVarInfo> inductionMap;
+        InductionTable inductionTable;
 
         void PrintInductionTable() {
-            errs() << "--------------IV_SR--------------\n";
-            for (auto [val, info] : inductionMap) {
-                errs() << "Instruction:" << *val << "\n";
-                errs() << "Parent:     " << *info.parent << "\n";
-                if (info.isPhi) {
-                    errs() << "phi: (" << *info.preheaderValue << "; ";
+            dbgs() << "--------------IV_SR--------------\n";
+            for (InductionVarInfo *info : inductionTable.records) {
+                dbgs() << "Instruction:" << *info->value << "\n";
+                if (info->isPhi) {
+                    dbgs() << "phi: ";
                 } else {
-                    errs() << "IndVar: (";
+                    dbgs() << "IndVar: ";
                 }
-                errs() << "*" << info.multiplicativeStep << ", ";
-                errs() << "+" << info.additiveStep << ")\n";
+                dbgs() << *info->addRec << "\n";
             }
-            errs() << "---------------------------------\n";
+            dbgs() << "---------------------------------\n";
         }
 
-        void PrintPhiMap(map<Value*, PHINode*> &PhiMap) {
-            errs() << "---PHI MAP---\n";
-            for (auto &p : PhiMap) {
-                errs() << "Value: ";
-                p.first->print(errs());
-                errs() << "\n";
-                errs() << "Phi: ";
-                p.second->print(errs());
-                errs() << "\n";
-            }
-            errs() << "-------------\n";
+        void PrintPhiMap() {
+            dbgs() << "---PHI MAP---\n";
+            for (InductionVarInfo *info : inductionTable.records) {
+                if (!info->phi) {
+                    continue;
+                }
+                dbgs() << "Value: ";
+                info->value->print(dbgs());
+                dbgs() << "\n";
+                dbgs() << "Phi: ";
+                info->phi->print(dbgs());
+                dbgs() << "\n";
+            }
+            dbgs() << "-------------\n";
         }
 
-        Value *CalculateNewIncomingValue(Instruction &position, InductionVarInfo indVarInfo) {
+        /*
+         * Start values and steps of an inner loop depend on the counters of the outer loops:
+         *     a[i * 100 + j]  -> {{a,+,400}<i>,+,4}<j>
+         * SCEVExpander calculates {a,+,400} with a new phi in the header of the outer loop,
+         * and of every loop around it in a deeper nest. Instead, every outer recurrence
+         * is calculated from a counter its loop already has:
+         *     {x,+,y}<L> = x + y / c * (i - i0)       ; i = {i0,+,c}<L>
+         * which is right in every iteration if c divides y, and the distance i - i0
+         * doesn't wrap in the type of y (i is wider, or it is nsw, or nuw and growing).
+         *
+         * A phi of L whose value is the recurrence itself is used as it is.
+         *
+         * When it is expanded, the value of an outer recurrence is calculated once, at the
+         * start of the header of its loop, and every inner loop uses that one. Its start x
+         * is the value of the recurrence of the next loop out, so a nest of any depth
+         * adds a mul and an add per loop (and reducing the outer loop later makes them a phi).
+         */
+        struct OuterCounterRewriter : public SCEVRewriteVisitor<OuterCounterRewriter> {
+            const Loop *loop;
+            // Without an expander the recurrences are only rewritten, nothing is inserted
+            SCEVExpander *expander;
+            DenseMap<const SCEV *, WeakTrackingVH> &values;
+            // A recurrence that is not of an outer loop, or whose loop has no such counter
+            bool failed = false;
+
+            OuterCounterRewriter(ScalarEvolution &SE, const Loop *loop, SCEVExpander *expander,
+                                 DenseMap<const SCEV *, WeakTrackingVH> &values)
+                : SCEVRewriteVisitor(SE), loop(loop), expander(expander), values(values) {}
+
+            const SCEV *visitAddRecExpr(const SCEVAddRecExpr *addRec) {
+                const Loop *outer = addRec->getLoop();
+                if (outer == loop || !outer->contains(loop) || !addRec->isAffine()) {
+                    failed = true;
+                    return addRec;
+                }
+
+                // A phi of the loop already has its value (a pointer counter p += n for p[j])
+                for (PHINode &phi : outer->getHeader()->phis()) {
+                    if (SE.isSCEVable(phi.getType()) && SE.getSCEV(&phi) == addRec) {
+                        return SE.getUnknown(&phi);
+                    }
+                }
+
+                // Expanded for another inner loop already, unless the outer loop replaced it with a phi since
+                if (Value *value = values.lookup(addRec)) {
+                    return SE.getUnknown(value);
+                }
+
+                const SCEV *start = visit(addRec->getStart());
+                const SCEV *step = visit(addRec->getStepRecurrence(SE));
+                for (PHINode &phi : outer->getHeader()->phis()) {
+                    const SCEV *product = GetProduct(phi, outer, step);
+                    if (!product) {
+                        continue;
+                    }
+
+                    const SCEV *rewritten = SE.getAddExpr(start, product);
+                    if (!expander) {
+                        return rewritten;
+                    }
+                    Value *value = expander->expandCodeFor(rewritten, addRec->getType(),
+                                                           &*outer->getHeader()->getFirstInsertionPt());
+                    values[addRec] = value;
+                    // ScalarEvolution calculates an add from the chain of adds on its left that it
+                    // doesn't know yet, and doesn't remember them. Outer values come first, so
+                    // if each one is known right away, no loop walks the chain over all outer loops.
+                    SE.getSCEV(value);
+                    return SE.getUnknown(value);
+                }
 
-            IRBuilder<> instructionBuilder(&position);
+                failed = true;
+                return addRec;
+            }
 
-            // It's important if counter starts from zero or something else.
-            // That's why we're multiplying initial value and multiplicative step.
-            Value *newIncomingValue = instructionBuilder.CreateMul(preHeaderValue,ConstantInt::getSigned(preHeaderValue->getType(), indVarInfo.multiplicativeStep));
-            newIncomingValue = instructionBuilder.CreateAdd(newIncomingValue, ConstantInt::getSigned(preHeaderValue->getType(), indVarInfo.additiveStep));
+            // y * (number of iterations of L) from the counter phi, nullptr if it can't be calculated from it
+            const SCEV *GetProduct(PHINode &phi, const Loop *outer, const SCEV *step) {
+                if (!phi.getType()->isIntegerTy()) {
+                    return nullptr;
+                }
 
-            return newIncomingValue;
+                auto *counter = dyn_cast<SCEVAddRecExpr>(SE.getSCEV(&phi));
+                if (!counter || counter->getLoop() != outer || !counter->isAffine()) {
+                    return nullptr;
+                }
+                auto *counterStep = dyn_cast<SCEVConstant>(counter->getStepRecurrence(SE));
+                Type *type = step->getType();
+                unsigned bitWidth = SE.getTypeSizeInBits(type);
+                if (!counterStep || counterStep->getValue()->isZero() ||
+                    counterStep->getAPInt().getMinSignedBits() > bitWidth) {
+                    return nullptr;
+                }
+
+                const APInt &c = counterStep->getAPInt();
+                const SCEV *value = SE.getUnknown(&phi);
+                const SCEV *first = counter->getStart();
+                if (c.getBitWidth() >= bitWidth) {
+                    value = SE.getTruncateOrNoop(value, type);
+                    first = SE.getTruncateOrNoop(first, type);
+                } else if (counter->hasNoSignedWrap()) {
+                    value = SE.getSignExtendExpr(value, type);
+                    first = SE.getSignExtendExpr(first, type);
+                } else if (counter->hasNoUnsignedWrap() && c.isStrictlyPositive()) {
+                    value = SE.getZeroExtendExpr(value, type);
+                    first = SE.getZeroExtendExpr(first, type);
+                } else {
+                    return nullptr;
+                }
+
+                // y / c, y is a constant or a product with a constant (2 * stride for i += 2)
+                APInt divisor = c.sextOrTrunc(bitWidth);
+                auto *product = dyn_cast<SCEVMulExpr>(step);
+                auto *constant = dyn_cast<SCEVConstant>(product ? product->getOperand(0) : step);
+                const SCEV *factor;
+                if (divisor.isOne()) {
+                    factor = step;
+                } else if (divisor.isAllOnes()) {
+                    factor = SE.getNegativeSCEV(step);
+                } else if (constant && constant->getAPInt().srem(divisor).isZero()) {
+                    SmallVector<const SCEV *, 4> operands{SE.getConstant(constant->getAPInt().sdiv(divisor))};
+                    if (product) {
+                        operands.append(std::next(product->op_begin()), product->op_end());
+                    }
+                    factor = SE.getMulExpr(operands);
+                } else {
+                    return nullptr;
+                }
+
+                return SE.getMulExpr(factor, SE.getMinusSCEV(value, first));
+            }
+        };
+
+        // Values of the outer recurrences that were expanded, see OuterCounterRewriter
+        DenseMap<const SCEV *, WeakTrackingVH> outerRecurrences;
+
+        /*
+         * S calculated from the counters the loops around the loop already have, nullptr
+         * if it can't be calculated at the end of the preheader, or if some outer loop has
+         * no counter to calculate it from. SCEVExpander would add a phi to that loop for
+         * every inner loop that needs it, and the cost model only sees the inner loop,
+         * so such a value is not reduced at all.
+         */
+        const SCEV *GetPreheaderSCEV(const SCEV *S, const Loop *loop) {
+            Instruction *preHeaderEnd = loop->getLoopPreheader()->getTerminator();
+            if (!SE->isLoopInvariant(S, loop) || !isSafeToExpandAt(S, preHeaderEnd, *SE)) {
+                return nullptr;
+            }
+
+            OuterCounterRewriter rewriter(*SE, loop, nullptr, outerRecurrences);
+            const SCEV *rewritten = rewriter.visit(S);
+            if (rewriter.failed) {
+                LLVM_DEBUG(dbgs() << "No counter in an outer loop for " << *S << "\n");
+                return nullptr;
+            }
+            return rewritten;
         }
 
-        bool runOnFunction(Function &F) override {
-            LoopInfo &loopInfo = getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
+        // S at the end of the preheader, GetPreheaderSCEV must have accepted it
+        Value *ExpandInPreheader(const SCEV *S, Type *type, const Loop *loop, SCEVExpander &expander) {
+            assert(GetPreheaderSCEV(S, loop) && "Value can't be calculated in the preheader");
+            OuterCounterRewriter rewriter(*SE, loop, &expander, outerRecurrences);
+            return expander.expandCodeFor(rewriter.visit(S), type, loop->getLoopPreheader()->getTerminator());
+        }
 
-            for (auto *loop: loopInfo) {
+        // Affine {start,+,step} of this loop, the step doesn't have to be a constant,
+        // it's enough that it doesn't change inside the loop (like `stride` above)
+        const SCEVAddRecExpr *GetInductionAddRec(Value *val, Loop *loop) {
+            bool isAddress = ReduceAddresses && isa<GetElementPtrInst>(val);
+            if (!(val->getType()->isIntegerTy() || isAddress) || !SE->isSCEVable(val->getType())) {
+                return nullptr;
+            }
 
-                BasicBlock *headerBasicBlock = loop->getHeader();
-                BasicBlock *preHeaderBasicBlock = loop->getLoopPreheader();
-                BasicBlock* incrementBasicBlock;
+            auto *addRec = dyn_cast<SCEVAddRecExpr>(SE->getSCEV(val));
+            if (!addRec) {
+                addRec = GetQuotientAddRec(val, loop);
+            }
+            if (!addRec || addRec->getLoop() != loop || addRec->getNumOperands() - 1 > MaxPolynomialDegree) {
+                return nullptr;
+            }
 
-                for (auto &Instr: *headerBasicBlock) {
-                    if (auto *phiNode = dyn_cast<PHINode>(&Instr)) {
+            // The start and all the differences are calculated in the preheader
+            for (const SCEV *operand : addRec->operands()) {
+                if (!GetPreheaderSCEV(operand, loop)) {
+                    return nullptr;
+                }
+            }
 
-                        InductionVarInfo indInfo;
-                        indInfo.isPhi = true;
-                        indInfo.multiplicativeStep = 1;
-                        indInfo.additiveStep = 0;
-                        indInfo.parent = &Instr;
+            return addRec;
+        }
 
-                        int n = phiNode->getNumIncomingValues();
-                        for (int i = 0; i < n; i++) {
-                            auto incomingBlock = phiNode->getIncomingBlock(i);
-                            if (incomingBlock == preHeaderBasicBlock) {
-                                indInfo.preheaderValue = phiNode->getIncomingValue(i);
+        /*
+         * i * (i + 1) / 2 is not a recurrence for ScalarEvolution, the product may wrap
+         * and then the division gives something else. When the product can't wrap (every
+         * operation it is calculated with is nsw for sdiv or nuw for udiv), it is one:
+         * {0,+,2,+,2} / 2 = {0,+,1,+,1}. Differences of a recurrence whose values fit
+         * in N bits need up to N + degree bits, so the dividend is built again in a type
+         * that is wide enough, and all of its differences are divided there.
+         */
+        const SCEVAddRecExpr *GetQuotientAddRec(Value *val, Loop *loop) {
+            auto *division = dyn_cast<BinaryOperator>(val);
+            if (!division || (division->getOpcode() != Instruction::SDiv && division->getOpcode() != Instruction::UDiv)) {
+                return nullptr;
+            }
 
-                                // Important if loop counter doesn't start from 1, ex: for (i = 3; i < 10; i++)
-                                preHeaderValue = phiNode->getIncomingValue(i);
-                            }
-                            else {
-                                // %for.inc block, we need it for later
-                                incrementBasicBlock = incomingBlock;
+            auto *divisor = dyn_cast<ConstantInt>(division->getOperand(1));
+            if (!divisor || !divisor->getValue().isPowerOf2() || divisor->getValue().isSignMask() || divisor->isOne()) {
+                return nullptr;
+            }
+
+            bool isSigned = division->getOpcode() == Instruction::SDiv;
+            unsigned bitWidth = division->getType()->getIntegerBitWidth();
+            unsigned shift = divisor->getValue().logBase2();
+            Type *wideType = IntegerType::get(division->getContext(), bitWidth + shift + MaxPolynomialDegree + 1);
+
+            auto *wideAddRec = dyn_cast_or_null<SCEVAddRecExpr>(
+                GetNoWrapSCEV(division->getOperand(0), loop, isSigned, wideType, 0));
+            if (!wideAddRec || wideAddRec->getLoop() != loop) {
+                return nullptr;
+            }
+
+            // Every value is divisible when all the differences are
+            SmallVector<const SCEV *, 4> operands;
+            for (const SCEV *operand : wideAddRec->operands()) {
+                auto *constant = dyn_cast<SCEVConstant>(operand);
+                if (!constant || constant->getAPInt().countTrailingZeros() < shift) {
+                    return nullptr;
+                }
+                operands.push_back(SE->getConstant(constant->getAPInt().ashr(shift).trunc(bitWidth)));
+            }
+
+            return dyn_cast<SCEVAddRecExpr>(SE->getAddRecExpr(operands, loop, SCEV::FlagAnyWrap));
+        }
+
+        // Recurrence of the value in the wide type, without wrapping. nullptr if any
+        // of the operations it's calculated with in the loop could wrap.
+        const SCEV *GetNoWrapSCEV(Value *val, Loop *loop, bool isSigned, Type *wideType, unsigned depth) {
+            auto extend = [&](const SCEV *narrow) {
+                return isSigned ? SE->getSignExtendExpr(narrow, wideType) : SE->getZeroExtendExpr(narrow, wideType);
+            };
+
+            if (!val->getType()->isIntegerTy()) {
+                return nullptr;
+            }
+            if (loop->isLoopInvariant(val)) {
+                return extend(SE->getSCEV(val));
+            }
+            if (depth > 8) {
+                return nullptr;
+            }
+
+            // Counter whose increment can't wrap has exactly the values start + k * step
+            if (auto *phi = dyn_cast<PHINode>(val)) {
+                // Phis that merge values inside the loop have no incoming value from the latch
+                if (phi->getParent() != loop->getHeader() || !inductionTable.contains(phi)) {
+                    return nullptr;
+                }
+
+                auto *addRec = dyn_cast<SCEVAddRecExpr>(SE->getSCEV(phi));
+                auto *increment = dyn_cast<BinaryOperator>(phi->getIncomingValueForBlock(loop->getLoopLatch()));
+                if (!addRec || !addRec->isAffine() || !increment ||
+                    increment->getOperand(0) != phi ||
+                    !(isSigned ? increment->hasNoSignedWrap() : increment->hasNoUnsignedWrap())) {
+                    return nullptr;
+                }
+                return SE->getAddRecExpr(extend(addRec->getStart()), extend(addRec->getStepRecurrence(*SE)), loop,
+                                         SCEV::FlagAnyWrap);
+            }
+
+            if (auto *extension = dyn_cast<CastInst>(val)) {
+                bool exact = extension->getOpcode() == (isSigned ? Instruction::SExt : Instruction::ZExt);
+                return exact ? GetNoWrapSCEV(extension->getOperand(0), loop, isSigned, wideType, depth + 1) : nullptr;
+            }
+
+            auto *binary = dyn_cast<OverflowingBinaryOperator>(val);
+            if (!binary || !(isSigned ? binary->hasNoSignedWrap() : binary->hasNoUnsignedWrap())) {
+                return nullptr;
+            }
+
+            const SCEV *lhs = GetNoWrapSCEV(binary->getOperand(0), loop, isSigned, wideType, depth + 1);
+            const SCEV *rhs = GetNoWrapSCEV(binary->getOperand(1), loop, isSigned, wideType, depth + 1);
+            if (!lhs || !rhs) {
+                return nullptr;
+            }
+
+            switch (binary->getOpcode()) {
+                case Instruction::Add:
+                    return SE->getAddExpr(lhs, rhs);
+                case Instruction::Sub:
+                    return SE->getMinusSCEV(lhs, rhs);
+                case Instruction::Mul:
+                    return SE->getMulExpr(lhs, rhs);
+                case Instruction::Shl: {
+                    // x << c is x * 2^c, a shift by a variable amount isn't a recurrence
+                    auto *amount = dyn_cast<ConstantInt>(binary->getOperand(1));
+                    if (!amount || amount->getValue().uge(amount->getBitWidth())) {
+                        return nullptr;
+                    }
+                    APInt power = APInt::getOneBitSet(wideType->getIntegerBitWidth(), amount->getZExtValue());
+                    return SE->getMulExpr(lhs, SE->getConstant(power));
+                }
+                default:
+                    return nullptr;
+            }
+        }
+
+        /*
+         * We don't want a new phi for:
+         *  - the counter itself and its increment (i.next)
+         *  - unfinished values (4 * i in 4 * i + 981) that are only used
+         *    to calculate other induction variables
+         * Everything else, scaled (4 * i) or just offset (i + 5), is a candidate,
+         * and the cost model decides if its phi pays off.
+         */
+        bool IsReductionCandidate(InductionVarInfo &indVarInfo, BasicBlock *latch) {
+            if (indVarInfo.isPhi) {
+                return false;
+            }
+
+            for (InductionVarInfo *counter : inductionTable.counters) {
+                if (cast<PHINode>(counter->value)->getIncomingValueForBlock(latch) == indVarInfo.value) {
+                    return false;
+                }
+            }
+
+            for (User *user : indVarInfo.value->users()) {
+                if (!inductionTable.contains(user)) {
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        // Values with the same recurrence and type (a[j] loaded and then stored) share one phi
+        struct ReductionCandidate {
+            const SCEVAddRecExpr *addRec = nullptr;
+            Type *type = nullptr;
+            SmallVector<InductionVarInfo *, 2> values;
+            // Per iteration: instructions that are not needed anymore, and the increment of the phi
+            InstructionCost saving = 0;
+            InstructionCost cost = 0;
+            bool selected = false;
+        };
+
+        using CandidateMap = MapVector<pair<const SCEV*, Type*>, ReductionCandidate>;
+
+        /*
+         * Cost of the instructions in the loop that become dead when the values are replaced
+         * by a phi. Instructions in dead are dead already (they are counted for the candidates
+         * selected before), the new ones are added to it, so an operand shared with them
+         * is counted once the last of its users is replaced. Operands that stay because
+         * something else uses them too are added to shared.
+         */
+        InstructionCost GetSaving(Loop *loop, ArrayRef<InductionVarInfo *> values, SmallPtrSetImpl<Instruction *> &dead,
+                                  SmallPtrSetImpl<Instruction *> *shared = nullptr) {
+            SmallVector<Instruction *, 16> worklist;
+            for (InductionVarInfo *info : values) {
+                // Uses after the loop keep the original value
+                auto *instr = cast<Instruction>(info->value);
+                if (llvm::all_of(instr->users(), [&](User *user) {
+                        return loop->contains(cast<Instruction>(user));
+                    })) {
+                    worklist.push_back(instr);
+                }
+            }
+
+            InstructionCost saving = 0;
+            while (!worklist.empty()) {
+                Instruction *instr = worklist.pop_back_val();
+                if (!dead.insert(instr).second) {
+                    continue;
+                }
+                InstructionCost instrCost = TTI->getInstructionCost(instr, TargetTransformInfo::TCK_RecipThroughput);
+                saving += instr->getOpcode() == Instruction::Mul ? instrCost * MulCostScale.getValue() : instrCost;
+
+                // The multiplications and extensions it was calculated from, unless something else needs them
+                for (Value *operand : instr->operands()) {
+                    auto *operandInstr = dyn_cast<Instruction>(operand);
+                    if (!operandInstr || isa<PHINode>(operandInstr) || !loop->contains(operandInstr)) {
+                        continue;
+                    }
+                    if (llvm::all_of(operandInstr->users(), [&](User *user) {
+                            return dead.count(cast<Instruction>(user));
+                        })) {
+                        worklist.push_back(operandInstr);
+                    } else if (shared) {
+                        shared->insert(operandInstr);
+                    }
+                }
+            }
+
+            return saving;
+        }
+
+        // Integer and pointer values that are live in every iteration: header phis,
+        // and values from before the loop that are used in it
+        unsigned CountLiveValues(Loop *loop) {
+            SmallPtrSet<Value *, 32> live;
+            for (PHINode &phi : loop->getHeader()->phis()) {
+                if (phi.getType()->isIntOrPtrTy()) {
+                    live.insert(&phi);
+                }
+            }
+
+            for (BasicBlock *BB : loop->blocks()) {
+                for (Instruction &Instr : *BB) {
+                    for (Value *operand : Instr.operands()) {
+                        auto *operandInstr = dyn_cast<Instruction>(operand);
+                        bool fromOutside = isa<Argument>(operand) || (operandInstr && !loop->contains(operandInstr));
+                        if (fromOutside && operand->getType()->isIntOrPtrTy()) {
+                            live.insert(operand);
+                        }
+                    }
+                }
+            }
+
+            return live.size();
+        }
+
+        /*
+         * A new phi pays off when the instructions it makes unnecessary cost more
+         * than its increment. The phi also occupies a register through the whole loop:
+         * once there are more live values than registers, every new one is spilled and
+         * costs a store and a load in each iteration, which a mul or a sext never does.
+         * The candidates that save the most get the free registers first. An operand
+         * they share (one sext for a[i] and b[i]) is counted for the last of them that
+         * is selected, and candidates that don't pay off alone are tried again together
+         * with the other ones they share operands with.
+         */
+        void SelectProfitableCandidates(Loop *loop, CandidateMap &candidates) {
+            if (!UseCostModel) {
+                for (auto &[recurrence, candidate] : candidates) {
+                    candidate.selected = true;
+                }
+                return;
+            }
+
+            TargetTransformInfo::TargetCostKind costKind = TargetTransformInfo::TCK_RecipThroughput;
+            SmallVector<ReductionCandidate *, 16> order;
+            for (auto &[recurrence, candidate] : candidates) {
+                // A polynomial has a phi and an add for each of its differences
+                unsigned degree = candidate.addRec->getNumOperands() - 1;
+                const SCEV *step = candidate.addRec->getOperand(degree);
+                Type *addType = candidate.type->isPointerTy() ? DL->getIndexType(candidate.type) : candidate.type;
+                SmallPtrSet<Instruction *, 16> dead;
+                candidate.saving = GetSaving(loop, candidate.values, dead);
+                candidate.cost = degree * TTI->getArithmeticInstrCost(Instruction::Add, addType, costKind,
+                                                                      TargetTransformInfo::OK_AnyValue,
+                                                                      isa<SCEVConstant>(step)
+                                                                          ? TargetTransformInfo::OK_UniformConstantValue
+                                                                          : TargetTransformInfo::OK_AnyValue);
+                order.push_back(&candidate);
+            }
+
+            llvm::stable_sort(order, [](const ReductionCandidate *a, const ReductionCandidate *b) {
+                return a->saving - a->cost > b->saving - b->cost;
+            });
+
+            unsigned registers = AvailableRegisters ? AvailableRegisters.getValue()
+                                                    : TTI->getNumberOfRegisters(TTI->getRegisterClassForType(false));
+            unsigned live = CountLiveValues(loop);
+            // Steps that are not constants are calculated in the preheader and are live too
+            SmallPtrSet<const SCEV *, 8> expandedSteps;
+            // Instructions the selected candidates make unnecessary
+            SmallPtrSet<Instruction *, 32> dead;
+
+            // Saving and cost of the candidates after the ones selected before, they are selected if it pays off
+            struct Evaluation {
+                InstructionCost saving = 0;
+                InstructionCost cost = 0;
+                bool selected = false;
+            };
+            auto trySelect = [&](ArrayRef<ReductionCandidate *> group, SmallPtrSetImpl<Instruction *> *shared) {
+                Evaluation evaluation;
+                SmallPtrSet<Instruction *, 32> groupDead(dead.begin(), dead.end());
+                SmallPtrSet<const SCEV *, 8> groupSteps(expandedSteps.begin(), expandedSteps.end());
+                unsigned newValues = 0;
+                InstructionCost spills = 0;
+                for (ReductionCandidate *candidate : group) {
+                    evaluation.saving += GetSaving(loop, candidate->values, groupDead, shared);
+
+                    unsigned degree = candidate->addRec->getNumOperands() - 1;
+                    const SCEV *step = candidate->addRec->getOperand(degree);
+                    unsigned candidateValues = degree + (!isa<SCEVConstant>(step) && groupSteps.insert(step).second);
+                    Align alignment = DL->getABITypeAlign(candidate->type);
+                    evaluation.cost += candidate->cost;
+                    spills += candidateValues * (TTI->getMemoryOpCost(Instruction::Store, candidate->type, alignment, 0, costKind) +
+                                                 TTI->getMemoryOpCost(Instruction::Load, candidate->type, alignment, 0, costKind));
+                    newValues += candidateValues;
+                }
+                if (live + newValues > registers) {
+                    evaluation.cost += spills;
+                }
+
+                if (!evaluation.saving.isValid() || !evaluation.cost.isValid() || evaluation.saving <= evaluation.cost) {
+                    return evaluation;
+                }
+
+                LLVM_DEBUG(dbgs() << "Profitable (saves " << evaluation.saving << ", costs " << evaluation.cost << "): "
+                                  << *group.front()->values.front()->value
+                                  << (group.size() > 1 ? " and the candidates it shares operands with" : "") << "\n");
+                for (ReductionCandidate *candidate : group) {
+                    candidate->selected = true;
+                }
+                evaluation.selected = true;
+                live += newValues;
+                dead = std::move(groupDead);
+                expandedSteps = std::move(groupSteps);
+                return evaluation;
+            };
+
+            // Operands that keep the rejected candidates from being profitable alone
+            MapVector<ReductionCandidate *, Evaluation> rejected;
+            MapVector<Instruction *, SmallVector<ReductionCandidate *, 2>> sharedBy;
+            for (ReductionCandidate *candidate : order) {
+                SmallPtrSet<Instruction *, 4> shared;
+                Evaluation evaluation = trySelect(candidate, &shared);
+                if (evaluation.selected) {
+                    continue;
+                }
+
+                rejected[candidate] = evaluation;
+                for (Instruction *operand : shared) {
+                    sharedBy[operand].push_back(candidate);
+                }
+            }
+
+            // Rejected candidates connected by the operands they share, the dead ones don't connect them
+            SmallPtrSet<ReductionCandidate *, 16> grouped;
+            for (auto &entry : rejected) {
+                ReductionCandidate *first = entry.first;
+                if (!grouped.insert(first).second) {
+                    continue;
+                }
+
+                SmallVector<ReductionCandidate *, 4> group{first};
+                for (unsigned i = 0; i < group.size(); i++) {
+                    for (auto &[operand, users] : sharedBy) {
+                        if (dead.count(operand) || !llvm::is_contained(users, group[i])) {
+                            continue;
+                        }
+                        for (ReductionCandidate *other : users) {
+                            if (!other->selected && grouped.insert(other).second) {
+                                group.push_back(other);
                             }
                         }
+                    }
+                }
+
+                // Alone again too, a candidate selected after it may have made its shared operands dead
+                trySelect(group, nullptr);
+            }
+
+            for (auto &[candidate, evaluation] : rejected) {
+                if (candidate->selected) {
+                    continue;
+                }
+
+                NumNotProfitable += candidate->values.size();
+                ORE->emit([&]() {
+                    return OptimizationRemarkMissed(DEBUG_TYPE, "NotProfitable",
+                                                    cast<Instruction>(candidate->values.front()->value))
+                           << "induction variable not reduced: it saves " << ore::NV("Saving", evaluation.saving)
+                           << " per iteration and a new phi costs " << ore::NV("Cost", evaluation.cost) << " ("
+                           << ore::NV("LiveValues", live) << " values live across the loop, "
+                           << ore::NV("Registers", registers) << " registers)";
+                });
+            }
+        }
+
+        Value *CalculateNewIncomingValue(BasicBlock *preHeaderBasicBlock, Type *type, const SCEVAddRecExpr *addRec, SCEVExpander &expander) {
+
+            // Computed once before the loop, at the end of the preheader.
+            // It's important if counter starts from zero or something else,
+            // or even from the counters of outer loops (see OuterCounterRewriter).
+            return ExpandInPreheader(addRec->getStart(), type, addRec->getLoop(), expander);
+        }
+
+        /*
+         * Phi with the start value of the recurrence. A polynomial recurrence is increased
+         * by its difference, which is a recurrence too and gets its own phi first:
+         *     {0,+,1,+,2} (i * i) needs {1,+,2} (2 * i + 1), which is increased by 2
+         * A difference that is also a candidate (2 * i + 1 computed in the loop) shares the phi.
+         */
+        PHINode *CreateRecurrencePhi(const SCEVAddRecExpr *addRec, Type *type, BasicBlock *preHeaderBasicBlock,
+                                     IRBuilder<> &phiBuilder, SCEVExpander &expander,
+                                     MapVector<pair<const SCEV*, Type*>, PHINode*> &RecurrencePhis) {
+            auto recurrence = make_pair(static_cast<const SCEV*>(addRec), type);
+            if (PHINode *phi = RecurrencePhis.lookup(recurrence)) {
+                return phi;
+            }
+
+            if (!addRec->isAffine()) {
+                auto *difference = cast<SCEVAddRecExpr>(addRec->getStepRecurrence(*SE));
+                CreateRecurrencePhi(difference, difference->getType(), preHeaderBasicBlock, phiBuilder, expander,
+                                    RecurrencePhis);
+            }
+
+            Value *newIncomingValue = CalculateNewIncomingValue(preHeaderBasicBlock, type, addRec, expander);
+            LLVM_DEBUG(dbgs() << "New incoming value: " << *newIncomingValue << "\n");
+
+            PHINode *newPhiNode = phiBuilder.CreatePHI(type, 2);
+
+            // Incoming block in %entry
+            // After this phi instr should look something like:  phi i64 [ <num>, %entry ]
+            newPhiNode->addIncoming(newIncomingValue, preHeaderBasicBlock);
+            RecurrencePhis[recurrence] = newPhiNode;
+            return newPhiNode;
+        }
+
+        // pointer + step bytes. Not inbounds, after the last iteration the pointer
+        // may be further than one past the end of the array.
+        Value *CreatePointerIncrement(IRBuilder<> &builder, Value *pointer, Value *step) {
+            Type *byteType = builder.getInt8Ty();
+            unsigned addressSpace = pointer->getType()->getPointerAddressSpace();
+
+            Value *bytePointer = builder.CreatePointerCast(pointer, byteType->getPointerTo(addressSpace));
+            Value *newPointer = builder.CreateGEP(byteType, bytePointer, step);
+            return builder.CreatePointerCast(newPointer, pointer->getType());
+        }
+
+        /*
+         * Linear function test replacement. The exit test of the counter
+         *     %c = icmp slt i32 %i, 10
+         * is replaced with a test of one of the new phis against the value it has
+         * in the iteration that leaves the loop
+         *     %c = icmp ne i32 %j, 31            ; j = 3 * i + 1
+         * so the counter and its increment are not needed anymore.
+         */
+        bool ReplaceExitTest(Loop *loop, MapVector<pair<const SCEV*, Type*>, PHINode*> &RecurrencePhis,
+                             SCEVExpander &expander) {
+            BasicBlock *exitingBlock = loop->getExitingBlock();
+            BasicBlock *latch = loop->getLoopLatch();
+            if (!exitingBlock || (exitingBlock != loop->getHeader() && exitingBlock != latch)) {
+                return false;
+            }
+
+            auto *branch = dyn_cast<BranchInst>(exitingBlock->getTerminator());
+            if (!branch || !branch->isConditional()) {
+                return false;
+            }
+
+            auto *compare = dyn_cast<ICmpInst>(branch->getCondition());
+            if (!compare || !compare->hasOneUse() || !loop->contains(compare)) {
+                return false;
+            }
 
-                        inductionMap[&Instr] = indInfo;
+            // The counter (or its next value) is compared with something that doesn't change in the loop
+            PHINode *counter = nullptr;
+            for (InductionVarInfo *info : inductionTable.counters) {
+                auto *phi = cast<PHINode>(info->value);
+                Value *next = phi->getIncomingValueForBlock(latch);
+                for (unsigned op = 0; op < 2; op++) {
+                    Value *side = compare->getOperand(op);
+                    if ((side == phi || side == next) && loop->isLoopInvariant(compare->getOperand(1 - op))) {
+                        counter = phi;
                     }
                 }
+            }
 
-                PrintInductionTable();
-                PrintBasicBlock(incrementBasicBlock, "--Increment BB--");
-
-                auto loopBlocks = loop->getBlocks();
-                for (auto BB: loopBlocks) {
-                    for (auto &Instr: *BB) {
-                        if (isa<BinaryOperator>(Instr)) {
-                            Value *left = Instr.getOperand(0);
-                            Value *right = Instr.getOperand(1);
-
-                            /*
-                            errs() << "Levi: " << inductionMap.count(left) << "\n";
-                            errs() << "\t" << *left << "\n";
-                            errs() << "Desni: " << inductionMap.count(right) << "\n";
-                            errs() << "\t" << *right << "\n";
-                             */
-
-                            // check if some induction variable is already in map
-                            if (inductionMap.count(left) || inductionMap.count(right)) {
-
-                                Value* constant = nullptr;
-                                Value* variable = nullptr;
-
-                                // Which one is constant?
-                                // We always assume that there will be one!
-                                if (IsConstantInt(left)) {
-                                    variable = right;
-                                    constant = left;
-                                } else if (IsConstantInt(right)) {
-                                    variable = left;
-                                    constant = right;
-                                }
-
-                                InductionVarInfo indVarOld = inductionMap[variable];
-                                int newFactor = GetConstantInt(constant);
-
-                                InductionVarInfo newIndVarInfo;
-                                newIndVarInfo.parent = indVarOld.parent;
-                                newIndVarInfo.isPhi = false;
-
-                                // We want to avoid division, subtraction with basic induction variable,
-                                // because our algorithm only works with multiplication and addition!
-                                if (isa<MulOperator>(Instr)) {
-                                    newIndVarInfo.multiplicativeStep = newFactor * indVarOld.multiplicativeStep;
-                                    newIndVarInfo.additiveStep = indVarOld.additiveStep;
-
-                                    inductionMap[&Instr] = newIndVarInfo;
-                                } else if (isa<AddOperator>(Instr)) {
-                                    newIndVarInfo.additiveStep = newFactor + indVarOld.additiveStep;
-                                    newIndVarInfo.multiplicativeStep = indVarOld.multiplicativeStep;
-
-                                    inductionMap[&Instr] = newIndVarInfo;
-                                }
-                            }
-                        } // if binaryOP
-                    } // end BB
-                } // end loopBlocks
-
-
-                PrintInductionTable();
-
-
-                // Map for new phi nodes
-                // Instruction -> Phi Node
-                map<Value*, PHINode*> PhiMap;
-
-                /*
-                 * We're making new phi instruction for every induction variable
-                 * that is not basic or unfinished.
-                 *
-                 * Our phi instruction will have two incoming values. One from %entry block
-                 * and one from %for.inc, in this loop we're making just the first part
-                 * (from %entry block).
-                 *
-                 * New phi instr must be placed before already existing (phi instr for counter).
-                 * That's why we're passing instruction `I` to CalculateNewIncomingValue func.
-                 */
-                for (auto &I: *headerBasicBlock) { // idemo kroz instrukcije header-a
-                    if (isa<PHINode>(&I)) {
-                        IRBuilder<> phiBuilder(&I);
-                        for (auto &indvar: inductionMap) {
-                            // avoid counter and unfinished (i, a, 0)
-                            if ((indvar.second.multiplicativeStep != 1 && indvar.second.additiveStep != 0)) {
-
-                                Value *newIncomingValue = CalculateNewIncomingValue(I, indvar.second);
-                                errs() << "New incoming value: " << *newIncomingValue << "\n";
-
-                                PHINode *newPhiNode = phiBuilder.CreatePHI(preHeaderValue->getType(), 2);
-
-                                // Incoming block in %entry
-                                // After this phi instr should look something like:  phi i64 [ <num>, %entry ]
-                                newPhiNode->addIncoming(newIncomingValue, preHeaderBasicBlock);
-                                PhiMap[indvar.first] = newPhiNode;
-                            }
+            if (!counter) {
+                return false;
+            }
+
+            // Nothing is gained if the counter is still needed for something else
+            auto *next = dyn_cast<Instruction>(counter->getIncomingValueForBlock(latch));
+            auto isOnlyCounting = [&](Value *val) {
+                return llvm::all_of(val->users(), [&](User *user) {
+                    return user == counter || user == next || user == compare;
+                });
+            };
+            if (!next || !isOnlyCounting(counter) || !isOnlyCounting(next)) {
+                return false;
+            }
+
+            const SCEV *exitCount = SE->getExitCount(loop, exitingBlock);
+            if (isa<SCEVCouldNotCompute>(exitCount)) {
+                return false;
+            }
+
+            // Integer phis are preferred, pointers are compared only if there's nothing else
+            for (bool pointers : {false, true}) {
+                for (auto &[recurrence, phi] : RecurrencePhis) {
+                    if (phi->getType()->isPointerTy() != pointers) {
+                        continue;
+                    }
+
+                    const SCEV *limit = GetExitValue(cast<SCEVAddRecExpr>(recurrence.first), exitCount);
+                    if (!limit || !GetPreheaderSCEV(limit, loop)) {
+                        continue;
+                    }
+
+                    Value *limitValue = ExpandInPreheader(limit, phi->getType(), loop, expander);
+                    IRBuilder<> builder(branch);
+                    CmpInst::Predicate predicate = loop->contains(branch->getSuccessor(0)) ? CmpInst::ICMP_NE
+                                                                                          : CmpInst::ICMP_EQ;
+                    branch->setCondition(builder.CreateICmp(predicate, phi, limitValue, "matf.exitcond"));
+                    compare->eraseFromParent();
+
+                    // The value after the last iteration is compared now, the increment that
+                    // computes it may wrap
+                    if (auto *increment = dyn_cast<BinaryOperator>(phi->getIncomingValueForBlock(latch))) {
+                        increment->setHasNoUnsignedWrap(false);
+                        increment->setHasNoSignedWrap(false);
+                    }
+
+                    LLVM_DEBUG(dbgs() << "New exit test:" << *branch->getCondition() << "\n");
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        /*
+         * start + step * exitCount, the value of the recurrence in the iteration that
+         * leaves the loop. The recurrence must not have that value in any earlier iteration,
+         * which holds if |step| * exitCount < 2^N. Returns nullptr if that isn't certain.
+         */
+        const SCEV *GetExitValue(const SCEVAddRecExpr *addRec, const SCEV *exitCount) {
+            auto *step = dyn_cast<SCEVConstant>(addRec->getStepRecurrence(*SE));
+            if (!step || step->getValue()->isZero()) {
+                return nullptr;
+            }
+
+            unsigned bitWidth = step->getAPInt().getBitWidth();
+            APInt maxExitCount = SE->getUnsignedRangeMax(exitCount);
+            unsigned wideWidth = bitWidth + maxExitCount.getBitWidth();
+            APInt span = step->getAPInt().abs().zext(wideWidth) * maxExitCount.zext(wideWidth);
+            if (span.getActiveBits() > bitWidth) {
+                return nullptr;
+            }
+
+            const SCEV *iterations = SE->getTruncateOrZeroExtend(exitCount, step->getType());
+            return SE->getAddExpr(addRec->getStart(), SE->getMulExpr(step, iterations));
+        }
+
+        /*
+         * Every continue path of a loop increments the counter on its own
+         *     odd:        %inc = add nsw i32 %i, 1
+         *     even:       %inc2 = add nsw i32 %i, 1
+         *     latch:      %i.be = phi [%inc, odd], [%inc2, even]
+         * and ScalarEvolution can't see a recurrence through the phi LoopSimplify
+         * merged them with. When all of them have the same SCEV, the phi is replaced
+         * with one increment in the latch, with the wrap flags all of them have.
+         */
+        bool MergeLatchIncrements(Loop *loop) {
+            BasicBlock *latch = loop->getLoopLatch();
+            if (!loop->getLoopPreheader() || !latch) {
+                return false;
+            }
+
+            bool merged = false;
+            for (PHINode &phi : loop->getHeader()->phis()) {
+                auto *latchPhi = dyn_cast<PHINode>(phi.getIncomingValueForBlock(latch));
+                if (!latchPhi || latchPhi->getParent() != latch || !SE->isSCEVable(phi.getType())) {
+                    continue;
+                }
+
+                auto *first = dyn_cast<BinaryOperator>(latchPhi->getIncomingValue(0));
+                if (!first || first->getOperand(0) != &phi || !loop->isLoopInvariant(first->getOperand(1))) {
+                    continue;
+                }
+
+                const SCEV *next = SE->getSCEV(first);
+                bool same = llvm::all_of(latchPhi->incoming_values(), [&](Value *incoming) {
+                    auto *increment = dyn_cast<BinaryOperator>(incoming);
+                    return increment && increment->getOpcode() == first->getOpcode() && SE->getSCEV(increment) == next;
+                });
+                if (!same) {
+                    continue;
+                }
+
+                Instruction *increment = first->clone();
+                for (Value *incoming : latchPhi->incoming_values()) {
+                    increment->andIRFlags(incoming);
+                }
+                increment->insertBefore(&*latch->getFirstInsertionPt());
+                increment->takeName(latchPhi);
+
+                SmallVector<WeakTrackingVH, 4> increments(latchPhi->incoming_values());
+                latchPhi->replaceAllUsesWith(increment);
+                latchPhi->eraseFromParent();
+                RecursivelyDeleteTriviallyDeadInstructionsPermissive(increments);
+
+                ++NumMergedIncrements;
+                merged = true;
+            }
+
+            // The values calculated from the counters are recurrences now
+            if (merged) {
+                SE->forgetLoop(loop);
+            }
+            return merged;
+        }
+
+        bool reduceFunction() {
+            bool modified = false;
+
+            /*
+             * Every loop in the nest is reduced, not just the top level ones.
+             * In preorder every loop comes before its subloops, so going in reverse
+             * we reduce the inner loops first. When the outer loop is reduced after that,
+             * its induction variables used inside the inner loops get reduced too.
+             */
+            SmallVector<Loop *, 8> loops = LI->getLoopsInPreorder();
+            for (auto *loop: reverse(loops)) {
+                if (!IsHotLoop(loop)) {
+                    continue;
+                }
+                modified |= MergeLatchIncrements(loop);
+                if (ReduceModular) {
+                    modified |= ReduceModularCounters(loop);
+                }
+                modified |= ReducePowCalls(loop);
+                modified |= ReduceLoop(loop);
+            }
+
+            return modified;
+        }
+
+        /*
+         * i % n and i / n of an induction variable i = {start,+,step} and a loop invariant n
+         * change in a simple way: the remainder grows by step % n and wraps around n, and
+         * the quotient grows by step / n and by one more when the remainder wraps:
+         *     preheader:  r0 = start % n, q0 = start / n, limit = n - step % n
+         *     latch:      wraps = r >= limit                 ; r + step % n >= n, without overflow
+         *                 r.next = wraps ? r - limit : r + step % n
+         *                 q.next = q + step / n + wraps
+         * When step / n is known to be 0 (a constant step smaller than a constant n, like
+         * i / 10 of i++), the quotient changes only when the remainder wraps:
+         *                 q.next = wraps ? q + 1 : q
+         * This is right only while i grows without wrapping, so i has to be nuw, or nsw and
+         * non-negative (then signed % and / are the same as unsigned ones, if n > 0 too).
+         * When n is a power of 2, a mask or a shift is cheaper than the counters, and knowing
+         * that i is non-negative, srem and sdiv don't need their bias for negative numbers.
+         */
+        struct ModularCounter {
+            PHINode *remainder = nullptr;
+            PHINode *quotient = nullptr;
+            // In the latch, the remainder went over the divisor
+            Value *wraps = nullptr;
+            // In the preheader, the divisor is never zero there
+            Value *start = nullptr;
+            Value *divisor = nullptr;
+            Value *stepQuotient = nullptr;
+        };
+
+        bool ReduceModularCounters(Loop *loop) {
+            if (!loop->getLoopPreheader() || !loop->getLoopLatch()) {
+                return false;
+            }
+
+            // Deleting the dead operands of one division may delete another one
+            SmallVector<WeakTrackingVH, 8> divisions;
+            for (BasicBlock *BB : loop->blocks()) {
+                for (auto &Instr : *BB) {
+                    if (IsModularCandidate(&Instr, loop)) {
+                        divisions.push_back(&Instr);
+                    }
+                }
+            }
+
+            if (divisions.empty()) {
+                return false;
+            }
+
+            unsigned registers = AvailableRegisters ? AvailableRegisters.getValue()
+                                                    : TTI->getNumberOfRegisters(TTI->getRegisterClassForType(false));
+            unsigned live = CountLiveValues(loop);
+
+            SCEVExpander expander(*SE, *DL, "matf.mod");
+            expander.disableCanonicalMode();
+
+            // Recurrence, divisor -> counters
+            MapVector<pair<const SCEV*, Value*>, ModularCounter> counters;
+            bool modified = false;
+            for (WeakTrackingVH &handle : divisions) {
+                auto *division = cast_or_null<BinaryOperator>(handle);
+                if (!division) {
+                    continue;
+                }
+
+                Value *dividend = division->getOperand(0);
+                Value *divisor = division->getOperand(1);
+                bool isQuotient = division->getOpcode() == Instruction::UDiv || division->getOpcode() == Instruction::SDiv;
+                Value *newValue;
+
+                const APInt *constant;
+                if (match(divisor, m_APInt(constant)) && constant->isPowerOf2()) {
+                    IRBuilder<> builder(division);
+                    newValue = isQuotient ? builder.CreateLShr(dividend, constant->logBase2())
+                                          : builder.CreateAnd(dividend, *constant - 1);
+                    ++NumModularMasks;
+                    ORE->emit([&]() {
+                        return OptimizationRemark(DEBUG_TYPE, "ModularMask", division)
+                               << ore::NV("Opcode", division->getOpcodeName())
+                               << " of an induction variable that is never negative replaced with a "
+                               << (isQuotient ? "shift" : "mask");
+                    });
+                } else {
+                    auto *addRec = cast<SCEVAddRecExpr>(SE->getSCEV(dividend));
+                    ModularCounter &counter = counters[make_pair(static_cast<const SCEV*>(addRec), divisor)];
+                    if (!counter.remainder) {
+                        if (UseCostModel && live + 2 > registers) {
+                            ++NumNotProfitable;
+                            ORE->emit([&]() {
+                                return OptimizationRemarkMissed(DEBUG_TYPE, "NotProfitable", division)
+                                       << ore::NV("Opcode", division->getOpcodeName())
+                                       << " of an induction variable not reduced: the counters need registers, and "
+                                       << ore::NV("LiveValues", live) << " values are live across the loop ("
+                                       << ore::NV("Registers", registers) << " registers)";
+                            });
+                            continue;
                         }
+                        CreateRemainderCounter(counter, addRec, divisor, loop, expander);
+                        live += 2;
+                    }
+                    if (isQuotient && !counter.quotient) {
+                        CreateQuotientCounter(counter, loop);
                     }
+
+                    newValue = isQuotient ? counter.quotient : counter.remainder;
+                    ++NumModularCounters;
+                    ORE->emit([&]() {
+                        return OptimizationRemark(DEBUG_TYPE, "ModularCounter", division)
+                               << ore::NV("Opcode", division->getOpcodeName())
+                               << " of an induction variable replaced with a counter that wraps around the divisor";
+                    });
                 }
 
-                PrintPhiMap(PhiMap);
-
-
-                /*
-                 * In this loop, we're finishing phi instructions by adding second part
-                 * to them, avoiding unfinished, (i, a, 0), indVar.
-                 */
-                for (auto &indvar: inductionMap) {
-                    if (PhiMap.count(indvar.first) &&
-                        (indvar.second.multiplicativeStep != 1 && indvar.second.additiveStep != 0)) {
-                        // errs() << "IndVar parent: " << *indvar.second.parent << "\n";
-                        // Prolazimo kroz instrukcije %for.inc basic block-a
-                        for (auto &I: *incrementBasicBlock) {
-                            if (auto op = dyn_cast<BinaryOperator>(&I)) {
-                                Value *lhs = op->getOperand(0);
-                                Value *rhs = op->getOperand(1);
-                                /*
-                                errs() << "Instrukcija: ";
-                                I.print(errs());
-                                errs() << "\nLeva strana: ";
-                                lhs->print(errs());
-                                errs() << "\nDesna strana: ";
-                                rhs->print(errs());
-                                errs() << "\n\n";
-                                 */
-
-                                // We are checking if one of the operands is a counter,
-                                // so we can recognize the increment instruction
-                                if (lhs == indvar.second.parent || rhs == indvar.second.parent) {
-
-                                    // for basic counter increment instruction
-                                    InductionVarInfo incIndVar = inductionMap[&I];
-                                    IRBuilder<> instructionBuilder(&I);
-
-                                    // We are calculating new increment by multiplying counter
-                                    // increment and ind var multiplicative factor
-                                    // example:
-                                    //     i -> (i, 1, 2);
-                                    //     j -> (i, 2, 981);
-                                    //     newIncrement = 2 * 2 = 4
-                                    int newIncrement = incIndVar.additiveStep * indvar.second.multiplicativeStep;
-
-                                    // Left hand side is phi instruction!
-                                    PHINode *phiVal = PhiMap[indvar.first];
-                                    errs() << "PhiVal: ";
-                                    phiVal->print(errs());
-                                    errs() << "\n";
-
-                                    Value *newIncrementInstruction = instructionBuilder.CreateAdd(phiVal,ConstantInt::getSigned(
-                                                                                         phiVal->getType(), newIncrement));
-
-                                    // Adding second part of phi instruction:
-                                    //    phi i64 [ <num>, %entry ], [ %newIncrementInstruction, %for.inc ]
-                                    phiVal->addIncoming(newIncrementInstruction, incrementBasicBlock);
-
-                                    //errs() << "Final phi instruction:   ";
-                                    //phiVal->print(errs());
-                                    //errs() << "\n";
-                                    errs() << "New increment instruction:" << *newIncrementInstruction << "\n";
-                                    errs() << "\n\n";
-                                }
-                            }
+                LLVM_DEBUG(dbgs() << "Replacing" << *division << "\n     with " << *newValue << "\n");
+                division->replaceAllUsesWith(newValue);
+                RecursivelyDeleteTriviallyDeadInstructions(division);
+                modified = true;
+            }
+
+            if (modified) {
+                SE->forgetLoop(loop);
+            }
+            return modified;
+        }
+
+        bool IsModularCandidate(Instruction *instr, Loop *loop) {
+            unsigned opcode = instr->getOpcode();
+            if (opcode != Instruction::URem && opcode != Instruction::UDiv &&
+                opcode != Instruction::SRem && opcode != Instruction::SDiv) {
+                return false;
+            }
+
+            Value *divisor = instr->getOperand(1);
+            if (!instr->getType()->isIntegerTy() || !loop->isLoopInvariant(divisor) || match(divisor, m_Zero())) {
+                return false;
+            }
+
+            auto *addRec = dyn_cast<SCEVAddRecExpr>(SE->getSCEV(instr->getOperand(0)));
+            if (!addRec || addRec->getLoop() != loop || !addRec->isAffine()) {
+                return false;
+            }
+
+            const SCEV *start = addRec->getStart();
+            const SCEV *step = addRec->getStepRecurrence(*SE);
+            if (!GetPreheaderSCEV(start, loop) || !GetPreheaderSCEV(step, loop)) {
+                return false;
+            }
+
+            // Growing, or staying the same, without wrapping
+            bool isNonNegative = addRec->hasNoSignedWrap() && SE->isKnownNonNegative(start) && SE->isKnownNonNegative(step);
+            if (opcode == Instruction::SRem || opcode == Instruction::SDiv) {
+                return isNonNegative && SE->isKnownPositive(SE->getSCEV(divisor));
+            }
+            return isNonNegative || addRec->hasNoUnsignedWrap();
+        }
+
+        void CreateRemainderCounter(ModularCounter &counter, const SCEVAddRecExpr *addRec, Value *divisor, Loop *loop,
+                                    SCEVExpander &expander) {
+            Type *type = divisor->getType();
+            Instruction *preHeaderEnd = loop->getLoopPreheader()->getTerminator();
+            counter.start = ExpandInPreheader(addRec->getStart(), type, loop, expander);
+            Value *step = ExpandInPreheader(addRec->getStepRecurrence(*SE), type, loop, expander);
+
+            // The preheader runs even if the division in the loop doesn't, it must not divide by zero
+            IRBuilder<> builder(preHeaderEnd);
+            counter.divisor = isa<Constant>(divisor)
+                                  ? divisor
+                                  : builder.CreateBinaryIntrinsic(Intrinsic::umax, builder.CreateFreeze(divisor),
+                                                                  ConstantInt::get(type, 1));
+            Value *start = builder.CreateURem(counter.start, counter.divisor, "matf.mod.start");
+            Value *stepRemainder = builder.CreateURem(step, counter.divisor);
+            Value *limit = builder.CreateSub(counter.divisor, stepRemainder, "matf.mod.limit");
+            counter.stepQuotient = builder.CreateUDiv(step, counter.divisor);
+
+            counter.remainder = PHINode::Create(type, 2, "matf.mod", &loop->getHeader()->front());
+            BasicBlock *incrementBasicBlock = loop->getLoopLatch();
+            builder.SetInsertPoint(incrementBasicBlock->getTerminator());
+            counter.wraps = builder.CreateICmpUGE(counter.remainder, limit, "matf.mod.wraps");
+            Value *next = builder.CreateSelect(counter.wraps, builder.CreateSub(counter.remainder, limit),
+                                               builder.CreateAdd(counter.remainder, stepRemainder), "matf.mod.next");
+            counter.remainder->addIncoming(start, loop->getLoopPreheader());
+            counter.remainder->addIncoming(next, incrementBasicBlock);
+            ++NumPhisCreated;
+        }
+
+        void CreateQuotientCounter(ModularCounter &counter, Loop *loop) {
+            Type *type = counter.divisor->getType();
+            IRBuilder<> builder(loop->getLoopPreheader()->getTerminator());
+            Value *start = builder.CreateUDiv(counter.start, counter.divisor, "matf.div.start");
+
+            counter.quotient = PHINode::Create(type, 2, "matf.div", &loop->getHeader()->front());
+            BasicBlock *incrementBasicBlock = loop->getLoopLatch();
+            builder.SetInsertPoint(incrementBasicBlock->getTerminator());
+            Value *next;
+            if (match(counter.stepQuotient, m_Zero())) {
+                next = builder.CreateSelect(counter.wraps, builder.CreateAdd(counter.quotient, ConstantInt::get(type, 1)),
+                                            counter.quotient, "matf.div.next");
+            } else {
+                next = builder.CreateAdd(counter.quotient, counter.stepQuotient);
+                next = builder.CreateAdd(next, builder.CreateZExt(counter.wraps, type), "matf.div.next");
+            }
+            counter.quotient->addIncoming(start, loop->getLoopPreheader());
+            counter.quotient->addIncoming(next, incrementBasicBlock);
+            ++NumPhisCreated;
+        }
+
+        /*
+         * pow(x, i) of an invariant x and a counter i = {start,+,step} is the product of the
+         * previous iteration multiplied by pow(x, step), so it gets a phi of its own:
+         *     preheader:  p0 = pow(x, start), factor = pow(x, step)
+         *     header:     p = phi [p0, preheader], [p.next, latch]
+         *     latch:      p.next = p * factor
+         * The product is rounded in every iteration, so the call needs afn or reassoc, and
+         * it must not set errno. The counter has to be non-negative and exactly converted
+         * to floating point, so pow(0, i) and pow(inf, i) are the same as the product.
+         */
+        bool ReducePowCalls(Loop *loop) {
+            BasicBlock *preHeaderBasicBlock = loop->getLoopPreheader();
+            BasicBlock *incrementBasicBlock = loop->getLoopLatch();
+            if (!preHeaderBasicBlock || !incrementBasicBlock) {
+                return false;
+            }
+
+            SmallVector<CallInst *, 4> calls;
+            // Calls in inner loops are reduced too when the exponent is the counter of this loop
+            for (BasicBlock *BB : loop->blocks()) {
+                for (auto &Instr : *BB) {
+                    if (auto *call = dyn_cast<CallInst>(&Instr)) {
+                        if (IsPowOfCounter(call, loop)) {
+                            calls.push_back(call);
                         }
                     }
                 }
+            }
+
+            if (calls.empty()) {
+                return false;
+            }
+
+            SCEVExpander expander(*SE, *DL, "matf.pow");
+            expander.disableCanonicalMode();
+
+            for (CallInst *call : calls) {
+                auto *conversion = cast<CastInst>(call->getArgOperand(1));
+                auto *addRec = cast<SCEVAddRecExpr>(SE->getSCEV(conversion->getOperand(0)));
+                Type *type = call->getType();
 
-                PrintPhiMap(PhiMap);
+                // Clones keep the flags and attributes of the call
+                Instruction *preHeaderEnd = preHeaderBasicBlock->getTerminator();
+                Value *start = ExpandInPreheader(addRec->getStart(), addRec->getType(), loop, expander);
+                IRBuilder<> builder(preHeaderEnd);
+                Instruction *initial = call->clone();
+                initial->setOperand(1, builder.CreateCast(conversion->getOpcode(), start, type));
+                builder.Insert(initial, "matf.pow.start");
 
-                // replace all the original uses with phi-node
-                for (auto &phi_val: PhiMap) {
-                    (phi_val.first)->replaceAllUsesWith(phi_val.second);
+                const APInt &step = cast<SCEVConstant>(addRec->getStepRecurrence(*SE))->getAPInt();
+                Value *factor = call->getArgOperand(0);
+                if (!step.isOne()) {
+                    Instruction *power = call->clone();
+                    power->setOperand(1, ConstantFP::get(type, double(step.getZExtValue())));
+                    factor = builder.Insert(power, "matf.pow.step");
                 }
 
+                PHINode *phi = PHINode::Create(type, 2, "matf.pow", &loop->getHeader()->front());
+                builder.SetInsertPoint(incrementBasicBlock->getTerminator());
+                builder.setFastMathFlags(call->getFastMathFlags());
+                Value *next = builder.CreateFMul(phi, factor, "matf.pow.next");
+                phi->addIncoming(initial, preHeaderBasicBlock);
+                phi->addIncoming(next, incrementBasicBlock);
 
-            } // finish all loops
+                LLVM_DEBUG(dbgs() << "Replacing" << *call << "\n     with " << *phi << "\n");
+                ORE->emit([&]() {
+                    return OptimizationRemark(DEBUG_TYPE, "PowToProduct", call)
+                           << ore::NV("Callee", call->getCalledFunction())
+                           << " of an induction variable replaced with a running product";
+                });
+
+                ++NumPowToProduct;
+                ++NumPhisCreated;
+                // The call doesn't touch memory, but it's not trivially dead without willreturn
+                call->replaceAllUsesWith(phi);
+                call->eraseFromParent();
+                RecursivelyDeleteTriviallyDeadInstructions(conversion);
+            }
 
             return true;
         }
+
+        bool IsPowOfCounter(CallInst *call, Loop *loop) {
+            LibFunc func;
+            bool isPow = call->getIntrinsicID() == Intrinsic::pow ||
+                         (call->getCalledFunction() && TLI->getLibFunc(*call, func) && TLI->has(func) &&
+                          (func == LibFunc_pow || func == LibFunc_powf || func == LibFunc_powl) &&
+                          call->doesNotAccessMemory());
+            if (!isPow || !call->getType()->isFloatingPointTy() || !(call->hasApproxFunc() || call->hasAllowReassoc()) ||
+                !loop->isLoopInvariant(call->getArgOperand(0))) {
+                return false;
+            }
+
+            auto *conversion = dyn_cast<CastInst>(call->getArgOperand(1));
+            if (!conversion || (conversion->getOpcode() != Instruction::SIToFP && conversion->getOpcode() != Instruction::UIToFP)) {
+                return false;
+            }
+
+            auto *addRec = dyn_cast<SCEVAddRecExpr>(SE->getSCEV(conversion->getOperand(0)));
+            if (!addRec || addRec->getLoop() != loop || !addRec->isAffine()) {
+                return false;
+            }
+
+            // pow(x, step) is calculated with a double constant
+            auto *step = dyn_cast<SCEVConstant>(addRec->getStepRecurrence(*SE));
+            if (!step || !step->getAPInt().isStrictlyPositive() || step->getAPInt().getActiveBits() > 32) {
+                return false;
+            }
+
+            if (!GetPreheaderSCEV(addRec->getStart(), loop)) {
+                return false;
+            }
+
+            // Every value of the counter is non-negative and exact in the floating point type
+            unsigned precision = APFloat::semanticsPrecision(call->getType()->getFltSemantics());
+            bool isSigned = conversion->getOpcode() == Instruction::SIToFP;
+            ConstantRange range = isSigned ? SE->getSignedRange(addRec) : SE->getUnsignedRange(addRec);
+            if (isSigned && range.getSignedMin().isNegative()) {
+                return false;
+            }
+            return range.getUnsignedMax().getActiveBits() <= precision;
+        }
+
+        /*
+         * With a profile (-fprofile-use) only hot loops are reduced. New phis occupy registers
+         * and the start values make the preheader longer, that pays off only in a loop that
+         * runs a lot. Without a profile every loop is reduced.
+         */
+        bool IsHotLoop(Loop *loop) {
+            BasicBlock *header = loop->getHeader();
+            if (!BFI || PSI->isHotBlockNthPercentile(HotCutoff, header, BFI)) {
+                return true;
+            }
+
+            ++NumColdLoops;
+            ORE->emit([&]() {
+                return OptimizationRemarkMissed(DEBUG_TYPE, "ColdLoop", loop->getStartLoc(), header)
+                       << "loop not reduced: it is not hot (the header runs "
+                       << ore::NV("Count", BFI->getBlockProfileCount(header).getValueOr(0)) << " times)";
+            });
+            return false;
+        }
+
+        bool ReduceLoop(Loop *loop) {
+            BasicBlock *headerBasicBlock = loop->getHeader();
+            BasicBlock *preHeaderBasicBlock = loop->getLoopPreheader();
+            BasicBlock *incrementBasicBlock = loop->getLoopLatch();
+
+            // Start values of new induction variables are calculated in the preheader,
+            // and the increments are placed in the %for.inc block. LoopSimplify can't
+            // make them when the loop is entered by an indirectbr or callbr.
+            if (!preHeaderBasicBlock || !incrementBasicBlock) {
+                ORE->emit([&]() {
+                    return OptimizationRemarkMissed(DEBUG_TYPE, "NotSimplified", loop->getStartLoc(), headerBasicBlock)
+                           << "loop not reduced: it has no preheader or more than one latch";
+                });
+                return false;
+            }
+
+            // Induction variables of the previous loop have nothing to do with this one
+            inductionTable.clear();
+
+            /*
+             * ScalarEvolution recognizes every affine value in the loop, no matter if it
+             * was calculated with add, sub, mul, shl, sext/zext or anything else.
+             * Blocks are visited in reverse post order, so every value is visited
+             * before its users.
+             */
+            LoopBlocksRPO loopBlocks(loop);
+            loopBlocks.perform(LI);
+            for (auto BB: loopBlocks) {
+                for (auto &Instr: *BB) {
+                    const SCEVAddRecExpr *addRec = GetInductionAddRec(&Instr, loop);
+                    if (!addRec) {
+                        continue;
+                    }
+
+                    inductionTable.insert(&Instr, addRec, isa<PHINode>(Instr) && BB == headerBasicBlock);
+                }
+            }
+
+            LLVM_DEBUG(PrintInductionTable());
+            LLVM_DEBUG(PrintBasicBlock(incrementBasicBlock, "--Increment BB--"));
+
+            CandidateMap candidates;
+            for (InductionVarInfo *indvar: inductionTable.records) {
+                if (!IsReductionCandidate(*indvar, incrementBasicBlock)) {
+                    continue;
+                }
+
+                // The type of an address recurrence is the type of the array,
+                // the phi has the type of the address itself
+                Type *type = indvar->value->getType();
+                ReductionCandidate &candidate = candidates[make_pair(static_cast<const SCEV*>(indvar->addRec), type)];
+                candidate.addRec = indvar->addRec;
+                candidate.type = type;
+                candidate.values.push_back(indvar);
+            }
+
+            if (candidates.empty()) {
+                ORE->emit([&]() {
+                    return OptimizationRemarkMissed(DEBUG_TYPE, "NoCandidates", loop->getStartLoc(), headerBasicBlock)
+                           << "loop not reduced: no induction variables besides the counters";
+                });
+                return false;
+            }
+
+            SelectProfitableCandidates(loop, candidates);
+
+            // Recurrence, type -> Phi Node
+            MapVector<pair<const SCEV*, Type*>, PHINode*> RecurrencePhis;
+
+            SCEVExpander expander(*SE, headerBasicBlock->getModule()->getDataLayout(), "matf.iv");
+            // Outer loop values in start values are expanded as they are, without
+            // going through multiplication of a canonical counter
+            expander.disableCanonicalMode();
+
+            /*
+             * We're making new phi instruction for every candidate
+             * the cost model selected.
+             *
+             * Our phi instruction will have two incoming values. One from %entry block
+             * and one from %for.inc, in this loop we're making just the first part
+             * (from %entry block).
+             *
+             * New phi instr must be placed before already existing (phi instr for counter),
+             * while its incoming value is calculated at the end of the preheader.
+             */
+            IRBuilder<> phiBuilder(&headerBasicBlock->front());
+            unsigned reducedCount = 0;
+            for (auto &[recurrence, candidate]: candidates) {
+                if (!candidate.selected) {
+                    continue;
+                }
+                reducedCount += candidate.values.size();
+
+                PHINode *newPhiNode = CreateRecurrencePhi(candidate.addRec, candidate.type, preHeaderBasicBlock,
+                                                          phiBuilder, expander, RecurrencePhis);
+                for (InductionVarInfo *indvar: candidate.values) {
+                    indvar->phi = newPhiNode;
+                }
+            }
+
+            // Every candidate was reported as not profitable
+            if (reducedCount == 0) {
+                return false;
+            }
+
+            LLVM_DEBUG(PrintPhiMap());
+
+            /*
+             * In this loop, we're finishing phi instructions by adding second part
+             * to them: the phi increased by the step of its recurrence, at the end
+             * of the %for.inc block.
+             *     j -> {993,+,8}
+             *     phi i64 [ 993, %entry ], [ %newIncrementInstruction, %for.inc ]
+             *     %newIncrementInstruction = add i64 %phi, 8
+             *
+             * A step that is not a constant (`stride * 2`) is calculated once in the
+             * preheader, so the loop itself only has the add. A polynomial is increased
+             * by the phi of its difference:
+             *     i * i -> {0,+,1,+,2}
+             *     %sq.next = add i32 %sq, %diff      ; diff -> {1,+,2}
+             *     %diff.next = add i32 %diff, 2
+             *
+             * Addresses are increased by their step in bytes:
+             *     %newIncrementInstruction = getelementptr i8, i8* %phi, i64 12
+             */
+            IRBuilder<> instructionBuilder(incrementBasicBlock->getTerminator());
+            for (auto &[recurrence, phiVal]: RecurrencePhis) {
+                auto *addRec = cast<SCEVAddRecExpr>(recurrence.first);
+                const SCEV *stepRecurrence = addRec->getStepRecurrence(*SE);
+                Value *step = addRec->isAffine()
+                                  ? ExpandInPreheader(stepRecurrence, stepRecurrence->getType(), loop, expander)
+                                  : RecurrencePhis.lookup(make_pair(stepRecurrence, stepRecurrence->getType()));
+
+                Value *newIncrementInstruction;
+                if (phiVal->getType()->isPointerTy()) {
+                    newIncrementInstruction = CreatePointerIncrement(instructionBuilder, phiVal, step);
+                } else {
+                    // If the recurrence can't overflow, neither can the increment. Polynomials
+                    // wrap the same way the multiplications did, modulo 2^N.
+                    newIncrementInstruction = instructionBuilder.CreateAdd(phiVal, step, "",
+                                                                           addRec->isAffine() && addRec->hasNoUnsignedWrap(),
+                                                                           addRec->isAffine() && addRec->hasNoSignedWrap());
+                }
+
+                // Adding second part of phi instruction:
+                //    phi i64 [ <num>, %entry ], [ %newIncrementInstruction, %for.inc ]
+                phiVal->addIncoming(newIncrementInstruction, incrementBasicBlock);
+
+                LLVM_DEBUG(dbgs() << "New increment instruction:" << *newIncrementInstruction << "\n");
+            }
+
+            /*
+             * Replace the original uses inside the loop with phi-node.
+             * After the loop the phi is one step ahead of the original value
+             * (it was already increased for the iteration that exits the loop),
+             * so uses outside the loop keep the original value.
+             */
+            for (InductionVarInfo *indvar: inductionTable.records) {
+                if (!indvar->phi) {
+                    continue;
+                }
+
+                if (indvar->phi->getType()->isPointerTy()) {
+                    ++NumReducedAddresses;
+                } else {
+                    ++NumReducedInductionVars;
+                }
+
+                indvar->value->replaceUsesWithIf(indvar->phi, [&](Use &U) {
+                    auto *user = dyn_cast<Instruction>(U.getUser());
+                    return user && loop->contains(user);
+                });
+            }
+
+            /*
+             * Replaced values that are not used after the loop are deleted, together with
+             * the multiplications and extensions they were calculated from. Counters
+             * are deleted too if the exit test was the last thing that needed them.
+             */
+            SmallVector<WeakTrackingVH, 16> replacedValues;
+            for (InductionVarInfo *indvar: inductionTable.records) {
+                if (indvar->phi) {
+                    replacedValues.push_back(indvar->value);
+                }
+            }
+            RecursivelyDeleteTriviallyDeadInstructionsPermissive(replacedValues);
+
+            bool replacedExitTest = ReplaceExitTest(loop, RecurrencePhis, expander);
+            if (replacedExitTest) {
+                ++NumExitTestsReplaced;
+                ORE->emit([&]() {
+                    return OptimizationRemark(DEBUG_TYPE, "ExitTestReplaced", loop->getStartLoc(), headerBasicBlock)
+                           << "exit test replaced with a test of a new phi";
+                });
+            }
+
+            SmallVector<WeakTrackingVH, 4> counters;
+            for (InductionVarInfo *counter: inductionTable.counters) {
+                counters.push_back(counter->value);
+            }
+            for (WeakTrackingVH &counter: counters) {
+                auto *phi = dyn_cast_or_null<PHINode>(counter);
+                if (phi && RecursivelyDeleteDeadPHINode(phi)) {
+                    ++NumCountersDeleted;
+                }
+            }
+
+            NumPhisCreated += RecurrencePhis.size();
+            ORE->emit([&]() {
+                return OptimizationRemark(DEBUG_TYPE, "Reduced", loop->getStartLoc(), headerBasicBlock)
+                       << "reduced " << ore::NV("NumInductionVars", reducedCount)
+                       << " induction variables to " << ore::NV("NumPhis", RecurrencePhis.size()) << " new phis";
+            });
+
+            /*
+             * The new phis have the values the replaced ones had, so what ScalarEvolution knows
+             * about the rest of the loop is still right. Only the backedge taken count was
+             * computed from the old exit test. Forgetting the whole loop every time would
+             * make the outer loops of a nest calculate every inner value again.
+             */
+            if (replacedExitTest) {
+                SE->forgetLoop(loop);
+            }
+            return true;
+        }
+    };
+
+    struct IndVarsStrengthReductionPass : public FunctionPass {
+        static char ID; // Pass identification, replacement for typeid
+        IndVarsStrengthReductionPass() : FunctionPass(ID) {}
+
+        /*
+         * LoopSimplify gives every loop a preheader for the start values and a single
+         * latch for the increments (loops with continue paths have several backedges,
+         * while loops after mem2reg often have no preheader). LCSSA keeps values used
+         * after the loop in phis of the exit blocks, so they are not mistaken for values
+         * that die in the loop. Both are kept by this pass, it only adds phis and
+         * instructions to existing blocks.
+         */
+        void getAnalysisUsage(AnalysisUsage &AU) const override {
+            AU.setPreservesCFG();
+            AU.addRequiredID(LoopSimplifyID);
+            AU.addRequiredID(LCSSAID);
+            AU.addPreservedID(LoopSimplifyID);
+            AU.addPreservedID(LCSSAID);
+            AU.addRequired<LoopInfoWrapperPass>();
+            AU.addRequired<ScalarEvolutionWrapperPass>();
+            AU.addRequired<TargetLibraryInfoWrapperPass>();
+            AU.addRequired<TargetTransformInfoWrapperPass>();
+            AU.addRequired<OptimizationRemarkEmitterWrapperPass>();
+            AU.addRequired<ProfileSummaryInfoWrapperPass>();
+            LazyBlockFrequencyInfoPass::getLazyBFIAnalysisUsage(AU);
+        }
+
+        bool runOnFunction(Function &F) override {
+            // Block frequencies are calculated only if they are needed
+            ProfileSummaryInfo *PSI = &getAnalysis<ProfileSummaryInfoWrapperPass>().getPSI();
+            BlockFrequencyInfo *BFI = PSI->hasProfileSummary() ? &getAnalysis<LazyBlockFrequencyInfoPass>().getBFI() : nullptr;
+
+            IndVarsStrengthReduction reduction(&getAnalysis<ScalarEvolutionWrapperPass>().getSE(),
+                                               &getAnalysis<LoopInfoWrapperPass>().getLoopInfo(),
+                                               &getAnalysis<TargetTransformInfoWrapperPass>().getTTI(F),
+                                               &getAnalysis<TargetLibraryInfoWrapperPass>().getTLI(F),
+                                               &F.getParent()->getDataLayout(),
+                                               &getAnalysis<OptimizationRemarkEmitterWrapperPass>().getORE(),
+                                               PSI, BFI);
+            return reduction.reduceFunction();
+        }
     };
 }
 
@@ -0,0 +1,66 @@
+#include <stdio.h>
+
+/* while, do/while and loops whose continue paths increment the counter on their own */
+
+#define SIZE 3000
+
+int a[3 * SIZE + 1];
+int b[4 * SIZE];
+
+/* Both paths of the loop end with their own i++ */
+void skip_odd(int n, int k)
+{
+    int i = 0;
+    while (i < n) {
+        if (i & 1) {
+            a[3 * i + 1] += k;
+            i++;
+            continue;
+        }
+        a[3 * i + 1] -= i;
+        i++;
+    }
+}
+
+/* The counter is incremented before the test, so the loop is rotated */
+void fill_stride(int n)
+{
+    int i = 0;
+    do {
+        b[4 * i + 2] = i * 5;
+        i++;
+    } while (i < n);
+}
+
+/* A continue path skips the store, the increment is in the for header */
+void clear_multiples(int n, int m)
+{
+    for (int i = 0; i < n; i++) {
+        if (i % m == 0) {
+            continue;
+        }
+        b[4 * i] = 3 * i + 7;
+    }
+}
+
+int main()
+{
+    long long sum = 0;
+
+    for (int k = 0; k < 200; k++) {
+        skip_odd(SIZE, k);
+        fill_stride(SIZE);
+        clear_multiples(SIZE, k % 7 + 2);
+    }
+
+    for (int i = 0; i < 3 * SIZE + 1; i++) {
+        sum += a[i];
+    }
+    for (int i = 0; i < 4 * SIZE; i++) {
+        sum += b[i];
+    }
+
+    printf("%lld\n", sum);
+
+    return 0;
+}
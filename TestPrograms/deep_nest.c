@@ -0,0 +1,63 @@
+#include <stdio.h>
+
+/* Deep loop nests whose innermost addresses depend on the counters of every outer loop */
+
+#define SIDE 3
+#define POINTS (SIDE * SIDE * SIDE * SIDE * SIDE * SIDE * SIDE * SIDE * SIDE * SIDE)
+
+int grid[POINTS];
+
+/* Ten nested loops over a ten-dimensional grid stored row by row */
+void fill_grid(int k)
+{
+    for (int i0 = 0; i0 < SIDE; i0++)
+    for (int i1 = 0; i1 < SIDE; i1++)
+    for (int i2 = 0; i2 < SIDE; i2++)
+    for (int i3 = 0; i3 < SIDE; i3++)
+    for (int i4 = 0; i4 < SIDE; i4++)
+    for (int i5 = 0; i5 < SIDE; i5++)
+    for (int i6 = 0; i6 < SIDE; i6++)
+    for (int i7 = 0; i7 < SIDE; i7++)
+    for (int i8 = 0; i8 < SIDE; i8++)
+    for (int i9 = 0; i9 < SIDE; i9++) {
+        int index = ((((((((i0 * SIDE + i1) * SIDE + i2) * SIDE + i3) * SIDE + i4) * SIDE + i5) * SIDE + i6)
+                      * SIDE + i7) * SIDE + i8) * SIDE + i9;
+        grid[index] += i0 + 2 * i5 - i9 + k;
+    }
+}
+
+/* Every counter has its own stride, like the generated nests of compile_bench.py */
+long long strided_sum(int n)
+{
+    long long sum = 0;
+    for (int i0 = 0; i0 < n; i0++)
+    for (int i1 = 0; i1 < n; i1++)
+    for (int i2 = 0; i2 < n; i2++)
+    for (int i3 = 0; i3 < n; i3++)
+    for (int i4 = 0; i4 < n; i4++)
+    for (int i5 = 0; i5 < n; i5++)
+    for (int i6 = 0; i6 < n; i6++)
+    for (int i7 = 0; i7 < n; i7++) {
+        int index = 2 * i0 + 3 * i1 + 5 * i2 + 7 * i3 + 11 * i4 + 13 * i5 + 17 * i6 + 19 * i7;
+        sum += grid[index % POINTS] * (long long)(i3 + 1);
+    }
+    return sum;
+}
+
+int main()
+{
+    long long sum = 0;
+
+    for (int k = 0; k < 20; k++) {
+        fill_grid(k);
+        sum += strided_sum(4);
+    }
+
+    for (int i = 0; i < POINTS; i++) {
+        sum += grid[i] * (long long)(i % 5);
+    }
+
+    printf("%lld\n", sum);
+
+    return 0;
+}
@@ -0,0 +1,21 @@
+#include <stdio.h>
+
+/* Division and modulo by constants that are not powers of two */
+
+int main()
+{
+    unsigned int usum = 0;
+    long long ssum = 0;
+
+    for (int i = -5 * 1000 * 1000; i < 5 * 1000 * 1000; i++)
+    {
+        unsigned int u = (unsigned int)i * 2654435761u;
+
+        usum += u / 10 + u % 1000 + u / 7;
+        ssum += i / 10 + i % 1000 + i / 7 + i % 3;
+    }
+
+    printf("%u %lld\n", usum, ssum);
+
+    return 0;
+}
@@ -34,10 +34,19 @@ int main() {
     int bar = foo / 4;
     printf("%d\n", bar);
 
+    int baz = -7;
+    long long lbaz = -7000000000LL;
+    printf("%d %d %lld %lld\n", baz / 4, baz % 4, lbaz / 8, lbaz % 8);
+
     unsigned int ufoo = 28;
     unsigned int ubar = ufoo / 4;
     printf("%u\n", ubar);
 
+    int num = -1234567;
+    unsigned int unum = 4000000000u;
+    printf("%d %d %d %d\n", num / 7, num % 7, num / 10, num % 1000);
+    printf("%u %u %u %u\n", unum / 7, unum % 7, unum / 10, unum % 1000);
+
     printf("Modulo [0, 10000) %% 4:\n");
     for (int i = 0; i < 10000; i++) {
         mod = i % 4;
@@ -0,0 +1,61 @@
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Floating point divisions by powers of two and multiplications by 2 are
+ * replaced with multiplications and additions. Results have to be the same
+ * to the last bit for NaN, infinities, denormals and signed zeros.
+ */
+
+static void print_bits(const char *name, double value)
+{
+    unsigned long long bits;
+    memcpy(&bits, &value, sizeof(bits));
+    printf("%-10s %016llx %a signbit=%d\n", name, bits, value, signbit(value) != 0);
+}
+
+static void print_float_bits(const char *name, float value)
+{
+    unsigned int bits;
+    memcpy(&bits, &value, sizeof(bits));
+    printf("%-10s %08x %a signbit=%d\n", name, bits, value, signbit(value) != 0);
+}
+
+int main()
+{
+    double inputs[] = {
+        NAN, -NAN, INFINITY, -INFINITY, 0.0, -0.0,
+        4.9406564584124654e-324,    /* smallest denormal */
+        2.2250738585072009e-308,    /* largest denormal */
+        DBL_MIN, -DBL_MIN, DBL_MAX, -DBL_MAX,
+        1.0, -3.0, 0.1, 1e300,
+    };
+    int count = sizeof(inputs) / sizeof(inputs[0]);
+
+    for (int i = 0; i < count; i++) {
+        double x = inputs[i];
+        printf("input %d\n", i);
+        print_bits("x / 2", x / 2.0);
+        print_bits("x / 4", x / 4.0);
+        print_bits("x / -8", x / -8.0);
+        print_bits("x / 0.5", x / 0.5);
+        print_bits("x / 3", x / 3.0);               /* not exact, stays a division */
+        print_bits("x / 2^1023", x / 0x1p1023);     /* reciprocal is a denormal, stays */
+        print_bits("x * 2", x * 2.0);
+        print_bits("2 * x", 2.0 * x);
+        print_float_bits("xf / 16", (float)x / 16.0f);
+        print_float_bits("xf * 2", (float)x * 2.0f);
+    }
+
+    /* Division by a value that doesn't change in the loop */
+    double divisor = 3.0;
+    double sum = 0;
+    for (int i = 0; i < 1000; i++) {
+        sum += i / divisor;
+    }
+    print_bits("sum", sum);
+
+    return 0;
+}
@@ -0,0 +1,50 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Image stored as one array, split into rows and columns with / and % by
+ * a width that is only known at run time. The magic number for the width
+ * is calculated once before the loop.
+ */
+
+unsigned tile_sums(const unsigned char *pixels, unsigned width, unsigned height, unsigned tile)
+{
+    unsigned tiles_per_row = (width + tile - 1) / tile;
+    unsigned *sums = calloc(tiles_per_row * ((height + tile - 1) / tile), sizeof(unsigned));
+
+    for (unsigned idx = 0; idx < width * height; idx++) {
+        unsigned row = idx / width;
+        unsigned col = idx % width;
+        sums[(row / tile) * tiles_per_row + col / tile] += pixels[idx];
+    }
+
+    unsigned result = 0;
+    for (unsigned i = 0; i < tiles_per_row * ((height + tile - 1) / tile); i++) {
+        result = result * 31 + sums[i];
+    }
+    free(sums);
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    /* Not constants, so the compiler can't see the divisors */
+    unsigned width = 1000 + argc - 1;
+    unsigned height = 700 + argc - 1;
+
+    unsigned char *pixels = malloc(width * height);
+    for (unsigned i = 0; i < width * height; i++) {
+        pixels[i] = (i * 2654435761u) >> 24;
+    }
+
+    unsigned result = 0;
+    for (unsigned tile = 1; tile <= 64; tile *= 2) {
+        result ^= tile_sums(pixels, width, height, tile);
+    }
+    result ^= tile_sums(pixels, width, height, 24);
+
+    printf("%u\n", result);
+
+    free(pixels);
+    return 0;
+}
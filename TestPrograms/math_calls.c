@@ -0,0 +1,55 @@
+#include <math.h>
+#include <stdio.h>
+
+/*
+ * pow and exp2 with constant or integer arguments are replaced with
+ * multiplications, sqrt and ldexp. With -ffast-math pow(x, i) in a loop
+ * becomes a running product.
+ */
+
+#define SIZE 1000
+
+double points[SIZE][3];
+
+double distance(const double *a, const double *b)
+{
+    double sum = 0;
+    for (int k = 0; k < 3; k++) {
+        sum += pow(a[k] - b[k], 2.0);
+    }
+    return pow(sum, 0.5);
+}
+
+/* Horner would be better, but this is how it's often written */
+double polynomial(const double *coefficients, int degree, double x)
+{
+    double sum = 0;
+    for (int i = 0; i <= degree; i++) {
+        sum += coefficients[i] * pow(x, i);
+    }
+    return sum;
+}
+
+int main()
+{
+    double coefficients[8] = {1.0, -0.5, 0.25, 3.0, -1.0, 0.125, 2.0, 0.5};
+    double total = 0;
+
+    for (int i = 0; i < SIZE; i++) {
+        points[i][0] = i % 17 - 8.0;
+        points[i][1] = exp2(i % 11 - 5);
+        points[i][2] = pow(i * 0.001, -1.0);
+    }
+
+    for (int i = 1; i < SIZE; i++) {
+        total += distance(points[i], points[i - 1]);
+    }
+
+    for (int i = 0; i < SIZE; i++) {
+        total += polynomial(coefficients, 7, points[i][0] / 8.0);
+    }
+
+    printf("%.6e\n", total);
+
+    return 0;
+}
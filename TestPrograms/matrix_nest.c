@@ -0,0 +1,48 @@
+#include <stdio.h>
+
+/* Two-deep nests whose inner addresses use the counter of the outer loop */
+
+#define ROWS 300
+#define COLS 100
+
+int a[ROWS * COLS];
+int b[ROWS * COLS];
+
+/* row * COLS + col: the outer counter is added to the inner one, there's no constant in the add */
+void add_matrix(int rows, int cols)
+{
+    for (int i = 0; i < rows; i++) {
+        for (int j = 0; j < cols; j++) {
+            a[i * COLS + j] += i - j;
+        }
+    }
+}
+
+/* Every point is the average of its left, right and upper neighbours */
+void stencil(int rows)
+{
+    for (int i = 1; i < rows; i++) {
+        for (int j = 1; j < COLS - 1; j++) {
+            b[i * COLS + j] = (a[i * COLS + j - 1] + a[i * COLS + j + 1] + a[(i - 1) * COLS + j]) / 3;
+        }
+    }
+}
+
+int main()
+{
+    long long sum = 0;
+
+    for (int k = 0; k < 100; k++) {
+        add_matrix(ROWS, COLS);
+        add_matrix(k % 37 + 1, k % 91 + 1);
+        stencil(ROWS);
+    }
+
+    for (int i = 0; i < ROWS * COLS; i++) {
+        sum += (long long)a[i] * (i % 7) + b[i];
+    }
+
+    printf("%lld\n", sum);
+
+    return 0;
+}
@@ -0,0 +1,61 @@
+#include <stdio.h>
+
+/* Squares, cubes and triangular numbers of loop counters */
+
+#define SIZE 2000
+
+int packed[SIZE * (SIZE + 1) / 2];
+unsigned squares[SIZE];
+int halves[SIZE];
+
+/* Lower triangle of a matrix stored row after row */
+void fill_triangle(int n, int k)
+{
+    for (int i = 0; i < n; i++) {
+        int row = i * (i + 1) / 2;
+        for (int j = 0; j <= i; j++) {
+            packed[row + j] += i * j - k;
+        }
+    }
+}
+
+/* Square of a value that is merged from i and i + 1 inside the loop */
+void fill_halves(int n)
+{
+    for (int i = 0; i < n; i++) {
+        int x = i % 3 == 0 ? i + 1 : i;
+        halves[i] = (x * x) / 2;
+    }
+}
+
+int main()
+{
+    long long sum = 0;
+
+    for (int k = 0; k < 20; k++) {
+        fill_triangle(SIZE, k);
+    }
+
+    for (int i = 0; i < SIZE; i++) {
+        squares[i] = i * i;
+    }
+    fill_halves(SIZE);
+
+    /* Wraps around for big i, the same way before and after the reduction */
+    unsigned cubes = 0;
+    for (unsigned i = 0; i < 100000; i++) {
+        cubes ^= i * i * i + 3 * i;
+    }
+
+    for (int i = 0; i < SIZE * (SIZE + 1) / 2; i++) {
+        sum += packed[i];
+    }
+    for (int i = 0; i < SIZE; i++) {
+        sum += squares[i];
+        sum += halves[i];
+    }
+
+    printf("%lld %u\n", sum, cubes);
+
+    return 0;
+}
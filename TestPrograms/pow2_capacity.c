@@ -0,0 +1,55 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Ring buffer and hash table whose capacities are powers of two that are
+ * only known at run time. Divisions and remainders by them become shifts
+ * and masks.
+ */
+
+struct ring {
+    unsigned *items;
+    unsigned capacity;
+    unsigned head;
+};
+
+void ring_push(struct ring *ring, unsigned value)
+{
+    assert((ring->capacity & (ring->capacity - 1)) == 0);
+    ring->items[ring->head % ring->capacity] = value;
+    ring->head++;
+}
+
+unsigned long bucket(unsigned long hash, unsigned shift)
+{
+    unsigned long buckets = 1UL << shift;
+    return (hash ^ (hash / buckets)) % buckets;
+}
+
+int main()
+{
+    struct ring ring = {0, 64, 0};
+    ring.items = calloc(ring.capacity, sizeof(unsigned));
+
+    for (unsigned i = 0; i < 1000000; i++) {
+        ring_push(&ring, i * 2654435761u);
+    }
+
+    unsigned long counts[1024] = {0};
+    for (unsigned long i = 0; i < 1000000; i++) {
+        counts[bucket(i * 11400714819323198485ul, 10)]++;
+    }
+
+    unsigned long sum = 0;
+    for (unsigned i = 0; i < ring.capacity; i++) {
+        sum += ring.items[i];
+    }
+    for (int i = 0; i < 1024; i++) {
+        sum = sum * 31 + counts[i];
+    }
+    printf("%lu\n", sum);
+
+    free(ring.items);
+    return 0;
+}
@@ -1,6 +1,6 @@
 #include <stdio.h>
 
-/* output: 1  4  7  10  13  16  19  22  25  28 */
+/* output: 1(-2)  4(-2)  7(-2)  10(-2)  13(-2)  16(-2)  19(-2)  22(-2)  25(-2)  28(-2) */
 /* 
  * j => <i, 3, 1>
  * van petlje novo j = 1, i u petlji se uvecava za 3
@@ -14,9 +14,9 @@ int main(int argc, const char** argv) {
     putchar('\n');
     for (int i = 0; i < 10; i = i + 1) {
       j = 3 * i + 1;
-      //a[j] = a[j] - 2;
+      a[j] = a[j] - 2;
       //i = i + 2;
-      printf("%d  ", j);
+      printf("%d(%d)  ", j, a[j]);
     }
     putchar('\n');
     putchar('\n');
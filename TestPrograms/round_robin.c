@@ -0,0 +1,47 @@
+#include <stdio.h>
+
+/*
+ * Round robin scheduling of jobs onto workers, and a matrix walked with
+ * one index. i % n and i / n become counters that wrap around n.
+ */
+
+#define JOBS 3000000
+#define MAX_WORKERS 64
+
+unsigned long load[MAX_WORKERS];
+unsigned long rounds[MAX_WORKERS];
+
+void schedule(int workers)
+{
+    for (int i = 0; i < JOBS; i++) {
+        load[i % workers] += i & 15;
+        rounds[i % workers] = i / workers;
+    }
+}
+
+long walk(int rows, int cols)
+{
+    long sum = 0;
+    for (int idx = 0; idx < rows * cols; idx += 3) {
+        int row = idx / cols;
+        int col = idx % cols;
+        sum += (long)row * 7 - col + idx % 4;
+    }
+    return sum;
+}
+
+int main(int argc, char **argv)
+{
+    int workers = 10 + argc;
+    unsigned long total = 0;
+
+    schedule(workers);
+    schedule(7);
+    for (int w = 0; w < MAX_WORKERS; w++) {
+        total = total * 31 + load[w] + rounds[w];
+    }
+
+    printf("%lu %ld\n", total, walk(1000, 999 + argc));
+
+    return 0;
+}
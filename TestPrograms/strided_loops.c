@@ -0,0 +1,41 @@
+#include <stdio.h>
+
+/* Strided array accesses and row * width + col indexing */
+
+#define SIZE 3000
+
+int a[3 * SIZE + 1];
+int image[SIZE * 64];
+
+void tile(int width, int height)
+{
+    for (int row = 0; row < height; row++) {
+        for (int col = 0; col < width; col++) {
+            image[row * width + col] += row - col;
+        }
+    }
+}
+
+int main()
+{
+    long long sum = 0;
+
+    for (int k = 0; k < 200; k++) {
+        for (int i = 0; i < SIZE; i++) {
+            a[3 * i + 1] = a[3 * i + 1] + i;
+            a[3 * i] = a[3 * i + 1] - 2 * k;
+        }
+        tile(64, SIZE);
+    }
+
+    for (int i = 0; i < 3 * SIZE + 1; i++) {
+        sum += a[i];
+    }
+    for (int i = 0; i < SIZE * 64; i++) {
+        sum += image[i];
+    }
+
+    printf("%lld\n", sum);
+
+    return 0;
+}
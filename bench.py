@@ -0,0 +1,308 @@
+#!/usr/bin/env python3
+"""
+Runtime benchmark for the strength reduction passes.
+
+Every C/C++ program in TestPrograms/ and indVarTest/ is compiled to LLVM IR,
+optimized with each pass configuration, compiled and run until the 95%
+confidence interval of its run time is tight enough. Outputs are compared
+with the baseline, and perf counters are collected when `perf` is available.
+
+Results are written as JSON, so runs from different commits can be compared:
+
+    ./bench.py -o before.json
+    ./bench.py -o after.json
+    ./bench.py --compare before.json after.json
+
+New kernels only need to be dropped into one of the program directories.
+"""
+
+import argparse
+import datetime
+import json
+import math
+import os
+import platform
+import shutil
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+SCRIPT_DIR = os.path.dirname(os.path.realpath(__file__))
+DEFAULT_BUILD_DIR = os.path.realpath(os.path.join(SCRIPT_DIR, "../../../../build"))
+PROGRAM_DIRS = ["TestPrograms", "indVarTest"]
+EXTENSIONS = (".c", ".cpp", ".c++")
+
+# Passes given to opt for every configuration, mem2reg is in the baseline too
+# so that only the effect of our passes is measured
+CONFIGS = {
+    "baseline": ["-mem2reg"],
+    "matf-arit-sr": ["-mem2reg", "-matf-arit-sr"],
+    "matf-iv-sr": ["-mem2reg", "-matf-iv-sr"],
+    "both": ["-mem2reg", "-matf-iv-sr", "-matf-arit-sr"],
+}
+
+# Cycles, instructions and divider activity (Intel name, ignored if not supported)
+PERF_EVENTS = ["cycles", "instructions", "arith.divider_active"]
+
+# Two-sided 95% Student t quantiles, index is degrees of freedom
+T_95 = [0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042]
+
+
+def t_quantile(dof):
+    if dof < len(T_95):
+        return T_95[dof]
+    return 1.960
+
+
+def confidence_interval(samples):
+    """Half-width of the 95% confidence interval of the mean."""
+    if len(samples) < 2:
+        return math.inf
+    return t_quantile(len(samples) - 1) * statistics.stdev(samples) / math.sqrt(len(samples))
+
+
+def run(cmd, **kwargs):
+    result = subprocess.run(cmd, capture_output=True, text=True, **kwargs)
+    if result.returncode != 0:
+        raise RuntimeError("command failed: {}\n{}".format(" ".join(cmd), result.stderr))
+    return result
+
+
+def find_programs(only):
+    programs = []
+    for directory in PROGRAM_DIRS:
+        path = os.path.join(SCRIPT_DIR, directory)
+        if not os.path.isdir(path):
+            continue
+        for name in sorted(os.listdir(path)):
+            base, ext = os.path.splitext(name)
+            if ext not in EXTENSIONS:
+                continue
+            if only and base not in only and "{}/{}".format(directory, base) not in only:
+                continue
+            programs.append((directory, os.path.join(path, name)))
+    return programs
+
+
+def build(args, source, config, work_dir):
+    """Builds one program in one configuration, returns the path of the executable."""
+    base = os.path.splitext(os.path.basename(source))[0]
+    # Programs with the same name can be in different directories
+    work_dir = os.path.join(work_dir, os.path.basename(os.path.dirname(source)))
+    os.makedirs(work_dir, exist_ok=True)
+    original_ll = os.path.join(work_dir, base + ".ll")
+    optimized_ll = os.path.join(work_dir, "{}_{}.ll".format(base, config))
+    executable = os.path.join(work_dir, "{}_{}".format(base, config))
+
+    if not os.path.exists(original_ll):
+        run([args.clang, "-fno-discard-value-names", "-O0", "-S", "-emit-llvm",
+             "-Xclang", "-disable-O0-optnone", source, "-o", original_ll])
+
+    run([args.opt, "-load", args.plugin, *CONFIGS[config], "-enable-new-pm=0",
+         original_ll, "-S", "-o", optimized_ll])
+    run([args.clang, optimized_ll, "-o", executable, "-lm"])
+    return executable
+
+
+def command_for(args, executable):
+    if args.cpu is not None and shutil.which("taskset"):
+        return ["taskset", "-c", str(args.cpu), executable]
+    return [executable]
+
+
+def run_program(cmd, cwd, **kwargs):
+    """Runs a benchmark program, a crash or a nonzero exit code is an error like in run()."""
+    result = subprocess.run(cmd, cwd=cwd, **kwargs)
+    if result.returncode != 0:
+        raise RuntimeError("program failed with exit code {}: {}".format(result.returncode, " ".join(cmd)))
+    return result
+
+
+def measure(args, executable, cwd):
+    """Runs the program until the confidence interval is within the target."""
+    cmd = command_for(args, executable)
+
+    for _ in range(args.warmup):
+        run_program(cmd, cwd, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+
+    samples = []
+    while len(samples) < args.max_runs:
+        start = time.perf_counter()
+        run_program(cmd, cwd, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        samples.append(time.perf_counter() - start)
+
+        if len(samples) >= args.min_runs:
+            mean = statistics.mean(samples)
+            if confidence_interval(samples) <= args.ci * mean:
+                break
+
+    return samples
+
+
+def perf_counters(args, executable, cwd):
+    if args.no_perf or not shutil.which("perf"):
+        return {}
+
+    cmd = ["perf", "stat", "-x", ",", "-e", ",".join(PERF_EVENTS), "--"] + command_for(args, executable)
+    result = subprocess.run(cmd, cwd=cwd, stdout=subprocess.DEVNULL, stderr=subprocess.PIPE, text=True)
+
+    counters = {}
+    for line in result.stderr.splitlines():
+        fields = line.split(",")
+        if len(fields) < 3:
+            continue
+        value, event = fields[0], fields[2]
+        if event in PERF_EVENTS and value.isdigit():
+            counters[event] = int(value)
+    return counters
+
+
+def program_output(executable, cwd):
+    return run_program([executable], cwd, capture_output=True).stdout
+
+
+def benchmark(args):
+    programs = find_programs(args.programs)
+    if not programs:
+        sys.exit("no programs found")
+
+    results = []
+    work_dir = tempfile.mkdtemp(prefix="matf-bench-")
+    try:
+        for directory, source in programs:
+            name = "{}/{}".format(directory, os.path.splitext(os.path.basename(source))[0])
+            cwd = os.path.dirname(source)
+            baseline_output = None
+            baseline_mean = None
+
+            for config in args.configs:
+                entry = {"program": name, "config": config}
+                try:
+                    executable = build(args, source, config, work_dir)
+                except RuntimeError as error:
+                    entry["error"] = str(error)
+                    results.append(entry)
+                    print("{:<28} {:<14} build failed".format(name, config), file=sys.stderr)
+                    continue
+
+                try:
+                    output = program_output(executable, cwd)
+                    samples = measure(args, executable, cwd)
+                except RuntimeError as error:
+                    entry["error"] = str(error)
+                    results.append(entry)
+                    print("{:<28} {:<14} run failed".format(name, config), file=sys.stderr)
+                    continue
+
+                if config == "baseline":
+                    baseline_output = output
+                mean = statistics.mean(samples)
+                if config == "baseline":
+                    baseline_mean = mean
+
+                entry.update({
+                    "runs": len(samples),
+                    "mean_s": mean,
+                    "median_s": statistics.median(samples),
+                    "min_s": min(samples),
+                    "stdev_s": statistics.stdev(samples) if len(samples) > 1 else 0.0,
+                    "ci95_s": confidence_interval(samples) if len(samples) > 1 else None,
+                    "speedup": baseline_mean / mean if baseline_mean else None,
+                    "output_matches": baseline_output is None or output == baseline_output,
+                    "counters": perf_counters(args, executable, cwd),
+                })
+                results.append(entry)
+
+                print("{:<28} {:<14} {:9.4f}s +- {:7.4f}s  x{:<6} {}".format(
+                    name, config, mean, entry["ci95_s"] or 0.0,
+                    "{:.3f}".format(entry["speedup"]) if entry["speedup"] else "-",
+                    "" if entry["output_matches"] else "OUTPUT DIFFERS"), file=sys.stderr)
+    finally:
+        if args.keep:
+            print("build files kept in " + work_dir, file=sys.stderr)
+        else:
+            shutil.rmtree(work_dir)
+
+    return {
+        "commit": git_commit(),
+        "date": datetime.datetime.now().isoformat(timespec="seconds"),
+        "host": platform.node(),
+        "machine": platform.machine(),
+        "cpu": args.cpu,
+        "ci_target": args.ci,
+        "configs": {config: CONFIGS[config] for config in args.configs},
+        "results": results,
+    }
+
+
+def git_commit():
+    try:
+        return run(["git", "-C", SCRIPT_DIR, "rev-parse", "HEAD"]).stdout.strip()
+    except (RuntimeError, OSError):
+        return None
+
+
+def compare(old_path, new_path):
+    with open(old_path) as old_file, open(new_path) as new_file:
+        old, new = json.load(old_file), json.load(new_file)
+
+    old_results = {(r["program"], r["config"]): r for r in old["results"] if "mean_s" in r}
+    print("{:<28} {:<14} {:>10} {:>10} {:>8}".format("program", "config", "old [s]", "new [s]", "change"))
+    for result in new["results"]:
+        key = (result["program"], result["config"])
+        if "mean_s" not in result or key not in old_results:
+            continue
+        old_mean = old_results[key]["mean_s"]
+        change = (result["mean_s"] - old_mean) / old_mean * 100
+        print("{:<28} {:<14} {:>10.4f} {:>10.4f} {:>+7.1f}%".format(key[0], key[1], old_mean, result["mean_s"], change))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--build-dir", default=DEFAULT_BUILD_DIR, help="LLVM build directory")
+    parser.add_argument("--plugin", help="path to MatfStrengthReductionPass.so (default: <build-dir>/lib)")
+    parser.add_argument("--configs", nargs="+", choices=list(CONFIGS), default=list(CONFIGS))
+    parser.add_argument("--programs", nargs="+",
+                        help="only these programs (name or directory/name, without extension)")
+    parser.add_argument("--cpu", type=int, default=0, help="pin the runs to this CPU with taskset")
+    parser.add_argument("--warmup", type=int, default=2, help="warm-up runs before measuring")
+    parser.add_argument("--min-runs", type=int, default=5)
+    parser.add_argument("--max-runs", type=int, default=50)
+    parser.add_argument("--ci", type=float, default=0.01,
+                        help="stop when the 95%% confidence interval is within this fraction of the mean")
+    parser.add_argument("--no-perf", action="store_true", help="don't collect perf counters")
+    parser.add_argument("-o", "--output", help="write the JSON results here (default: stdout)")
+    parser.add_argument("-k", "--keep", action="store_true", help="keep the .ll files and executables")
+    parser.add_argument("--compare", nargs=2, metavar=("OLD", "NEW"), help="compare two JSON result files")
+    args = parser.parse_args()
+
+    if args.compare:
+        compare(*args.compare)
+        return
+
+    bin_dir = os.path.join(args.build_dir, "bin")
+    args.clang = os.path.join(bin_dir, "clang")
+    args.opt = os.path.join(bin_dir, "opt")
+    args.plugin = args.plugin or os.path.join(args.build_dir, "lib", "MatfStrengthReductionPass.so")
+    args.min_runs = max(args.min_runs, 2)
+    args.max_runs = max(args.max_runs, args.min_runs)
+
+    report = benchmark(args)
+    text = json.dumps(report, indent=2)
+    if args.output:
+        with open(args.output, "w") as output:
+            output.write(text + "\n")
+    else:
+        print(text)
+
+    # The report is written anyway, the failures are in it
+    if any("error" in result for result in report["results"]):
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,430 @@
+#!/usr/bin/env python3
+"""
+Compile-time scalability benchmark for the strength reduction passes.
+
+Synthetic modules of growing size are generated for every shape that stresses
+the passes: many functions, one very long basic block, deep loop nests and a
+loop with hundreds of derived induction variables. Each module is run through
+opt with every pass configuration, under -time-passes, and the peak RSS of opt
+is measured. Time and memory are reported against the number of instructions,
+together with the growth exponents from the smallest measurable size (1 is
+linear, 2 quadratic) of the total time and of each pass alone, so superlinear
+behaviour shows up on small inputs already:
+
+    ./compile_bench.py -o before.json
+    ./compile_bench.py -o after.json
+    ./compile_bench.py --compare before.json after.json
+
+--check exits with an error when a growth exponent is over --max-exponent.
+"""
+
+import argparse
+import datetime
+import json
+import math
+import os
+import platform
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+
+SCRIPT_DIR = os.path.dirname(os.path.realpath(__file__))
+DEFAULT_BUILD_DIR = os.path.realpath(os.path.join(SCRIPT_DIR, "../../../../build"))
+
+# The baseline only parses and verifies, its peak RSS is subtracted from the others
+CONFIGS = {
+    "baseline": [],
+    "matf-arit-sr": ["-matf-arit-sr"],
+    "matf-iv-sr": ["-matf-iv-sr"],
+    "both": ["-matf-iv-sr", "-matf-arit-sr"],
+}
+
+# Names of the passes in the -time-passes report
+PASS_NAMES = {
+    "MATF arithmetic strength reduction": "matf-arit-sr",
+    "MATF strength reduction of induction variables": "matf-iv-sr",
+}
+
+# Growth exponents of runs shorter than this are mostly noise
+MIN_SECONDS = 0.01
+
+# Times whose growth is checked: one pass can be superlinear while the total is dominated by the rest
+GROWTH_KEYS = ["total_s", "arit_s", "iv_s"]
+
+
+def many_functions(size):
+    """Small loops with divisions, remainders and array accesses in `size` functions."""
+    lines = []
+    for k in range(size):
+        lines += [
+            "define void @f{}(i32* %a, i32 %n) {{".format(k),
+            "entry:",
+            "  %c0 = icmp sgt i32 %n, 0",
+            "  br i1 %c0, label %loop, label %exit",
+            "loop:",
+            "  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]",
+            "  %m = mul nsw i32 %i, 3",
+            "  %idx = add nsw i32 %m, {}".format(k % 7),
+            "  %q = udiv i32 %i, 7",
+            "  %r = urem i32 %i, 10",
+            "  %v = add i32 %q, %r",
+            "  %w = mul i32 %v, {}".format(k % 13 + 3),
+            "  %p = getelementptr inbounds i32, i32* %a, i32 %idx",
+            "  store i32 %w, i32* %p",
+            "  %i.next = add nuw nsw i32 %i, 1",
+            "  %c = icmp slt i32 %i.next, %n",
+            "  br i1 %c, label %loop, label %exit",
+            "exit:",
+            "  ret void",
+            "}",
+            "",
+        ]
+    return lines
+
+
+def long_block(size):
+    """One basic block with `size` multiplications, divisions and remainders by constants."""
+    operations = [
+        "mul i32 {}, {}",
+        "udiv i32 {}, {}",
+        "urem i32 {}, {}",
+        "sdiv i32 {}, 8",
+        "add i32 {}, %y",
+        "mul i32 {}, 16",
+    ]
+    lines = ["define i32 @block(i32 %x, i32 %y) {", "entry:"]
+    previous = "%x"
+    for k in range(size):
+        operation = operations[k % len(operations)]
+        lines.append("  %t{} = {}".format(k, operation.format(previous, k % 11 + 3)))
+        previous = "%t{}".format(k)
+    lines += ["  ret i32 {}".format(previous), "}", ""]
+    return lines
+
+
+def loop_nest(size):
+    """`size` nested loops, the innermost one stores to a[2 * i0 + 3 * i1 + ...]."""
+    lines = ["define void @nest(i32* %a, i32 %n) {", "entry:", "  br label %h0"]
+    for k in range(size):
+        predecessor = "entry" if k == 0 else "h{}".format(k - 1)
+        lines += [
+            "h{}:".format(k),
+            "  %i{0} = phi i32 [ 0, %{1} ], [ %i{0}.next, %l{0} ]".format(k, predecessor),
+        ]
+        if k + 1 < size:
+            lines.append("  br label %h{}".format(k + 1))
+
+    previous = "0"
+    for k in range(size):
+        lines += [
+            "  %m{} = mul nsw i32 %i{}, {}".format(k, k, k + 2),
+            "  %s{} = add nsw i32 {}, %m{}".format(k, previous, k),
+        ]
+        previous = "%s{}".format(k)
+    lines += [
+        "  %p = getelementptr inbounds i32, i32* %a, i32 {}".format(previous),
+        "  store i32 0, i32* %p",
+        "  br label %l{}".format(size - 1),
+    ]
+
+    for k in reversed(range(size)):
+        exit_block = "exit" if k == 0 else "l{}".format(k - 1)
+        lines += [
+            "l{}:".format(k),
+            "  %i{0}.next = add nuw nsw i32 %i{0}, 1".format(k),
+            "  %c{0} = icmp slt i32 %i{0}.next, %n".format(k),
+            "  br i1 %c{0}, label %h{0}, label %{1}".format(k, exit_block),
+        ]
+    lines += ["exit:", "  ret void", "}", ""]
+    return lines
+
+
+def nest_work(lines):
+    """Instructions of loop_nest counted once for every loop they are in, h<k> and l<k> are in k + 1."""
+    work = 0
+    loops = 1
+    for line in lines:
+        label = re.match(r"([hl])(\d+):", line)
+        if label:
+            loops = int(label.group(2)) + 1
+        elif line == "exit:":
+            loops = 1
+        elif line.startswith("  "):
+            work += loops
+    return work
+
+
+def derived_ivs(size):
+    """One loop with `size` induction variables derived from the counter (a[(k + 2) * i + k])."""
+    lines = [
+        "define void @ivs(i32* %a, i32 %n) {",
+        "entry:",
+        "  br label %loop",
+        "loop:",
+        "  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]",
+    ]
+    for k in range(size):
+        lines += [
+            "  %d{} = mul nsw i32 %i, {}".format(k, k + 2),
+            "  %e{} = add nsw i32 %d{}, {}".format(k, k, k),
+            "  %p{} = getelementptr inbounds i32, i32* %a, i32 %e{}".format(k, k),
+            "  store i32 %i, i32* %p{}".format(k),
+        ]
+    lines += [
+        "  %i.next = add nuw nsw i32 %i, 1",
+        "  %c = icmp slt i32 %i.next, %n",
+        "  br i1 %c, label %loop, label %exit",
+        "exit:",
+        "  ret void",
+        "}",
+        "",
+    ]
+    return lines
+
+
+# Sizes double, so the time of a linear pass doubles too. Extra options are given to opt
+# together with the passes: without the cost model every derived IV gets a phi, with it
+# (the default) most of them are left alone because they don't fit in the registers, but
+# the candidates are evaluated against each other, so both are measured.
+# Growth is measured against the instructions, or against what the last function counts:
+# a loop pass looks at the body of every loop, and in a nest the innermost block is in
+# all of them, so that grows with the square of the depth even when the pass is linear.
+GENERATORS = {
+    "functions": (many_functions, [500, 1000, 2000, 4000], [], None),
+    "block": (long_block, [2000, 4000, 8000, 16000], [], None),
+    "nest": (loop_nest, [8, 16, 32, 64], [], nest_work),
+    "ivs": (derived_ivs, [100, 200, 400, 800], [], None),
+    "ivs-all": (derived_ivs, [100, 200, 400, 800], ["-matf-iv-sr-cost-model=false"], None),
+}
+
+
+def generate(name, size, work_dir):
+    """Writes the module, returns its path, the number of instructions and the size growth is measured against."""
+    generator, _, _, work = GENERATORS[name]
+    lines = generator(size)
+    path = os.path.join(work_dir, "{}_{}.ll".format(name, size))
+    with open(path, "w") as module:
+        module.write("\n".join(lines))
+    instructions = sum(1 for line in lines if line.startswith("  "))
+    return path, instructions, work(lines) if work else instructions
+
+
+def parse_time_passes(report):
+    """Wall time of every pass from the legacy pass manager's -time-passes report."""
+    passes = {}
+    section = report.split("Pass execution timing report", 1)
+    if len(section) < 2:
+        return passes
+
+    columns = None
+    for line in section[1].splitlines():
+        if "--- Name ---" in line:
+            columns = re.findall(r"-+\s*([\w+ ]+?)\s*-+", line)
+            continue
+        if columns is None or not line.strip():
+            if columns is not None:
+                break
+            continue
+
+        times = re.findall(r"(\d+\.\d+) \(\s*[\d.]+%\)", line)
+        rest = re.sub(r"\d+\.\d+ \(\s*[\d.]+%\)", "", line).split(None, 1)
+        wall = times[columns.index("Wall Time")]
+        name = rest[1] if "Mem" in columns else " ".join(rest)
+        passes[name.strip()] = {"wall_s": float(wall)}
+    return passes
+
+
+def run_opt(args, module, options):
+    """Runs opt once, returns its -time-passes report and peak RSS in bytes."""
+    with tempfile.TemporaryFile(mode="w+") as report:
+        # No -track-memory: it calls mallinfo around every pass, which walks the whole heap,
+        # so with many functions it takes most of the time and grows quadratically
+        cmd = [args.opt, "-load", args.plugin, "-enable-new-pm=0", *options,
+               "-time-passes", "-disable-output", module]
+        process = subprocess.Popen(cmd, stdout=subprocess.DEVNULL, stderr=report)
+        # wait4 gives the resource usage of this process alone
+        _, status, usage = os.wait4(process.pid, 0)
+        process.returncode = os.waitstatus_to_exitcode(status)
+        report.seek(0)
+        output = report.read()
+
+    if process.returncode != 0:
+        raise RuntimeError("command failed: {}\n{}".format(" ".join(cmd), output))
+    # ru_maxrss is in kilobytes on Linux
+    return parse_time_passes(output), usage.ru_maxrss * 1024
+
+
+def measure(args, module, options):
+    """Best of --repeat runs: the shortest pass times and the smallest peak RSS."""
+    runs = [run_opt(args, module, options) for _ in range(args.repeat)]
+    passes = min((passes for passes, _ in runs), key=lambda passes: passes.get("Total", {}).get("wall_s", 0.0))
+    return {
+        "total_s": passes.get("Total", {}).get("wall_s", 0.0),
+        "passes": passes,
+        "peak_rss": min(peak_rss for _, peak_rss in runs),
+    }
+
+
+def growth_exponent(previous, current, key):
+    """Exponent k of time ~ work^k from the smallest of the previous sizes whose time is
+    long enough, None when there is none. Over several doublings the noise of one run matters less."""
+    first = next((entry for entry in previous if entry[key] >= MIN_SECONDS), None)
+    if not first or current[key] < MIN_SECONDS:
+        return None
+    return math.log(current[key] / first[key]) / math.log(current["work"] / first["work"])
+
+
+def benchmark(args):
+    results = []
+    superlinear = []
+    work_dir = tempfile.mkdtemp(prefix="matf-compile-bench-")
+    try:
+        print("{:<10} {:>6} {:>7} {:<14} {:>9} {:>9} {:>9} {:>9} {:>9} {:>9} {:>7}".format(
+            "generator", "size", "insts", "config", "arit [s]", "iv [s]", "other [s]",
+            "total [s]", "RSS [MB]", "+RSS [MB]", "growth"), file=sys.stderr)
+
+        for name in args.generators:
+            _, sizes, extra_options, _ = GENERATORS[name]
+            previous = {}
+            for size in (max(1, int(size * args.scale)) for size in sizes):
+                module, instructions, work = generate(name, size, work_dir)
+                baseline_rss = None
+
+                for config in ["baseline"] + args.configs:
+                    entry = {"generator": name, "size": size, "instructions": instructions, "work": work, "config": config}
+                    options = CONFIGS[config] + (extra_options if CONFIGS[config] else [])
+                    try:
+                        measured = measure(args, module, options)
+                    except RuntimeError as error:
+                        entry["error"] = str(error)
+                        results.append(entry)
+                        print("{:<10} {:>6} {:>7} {:<14} failed".format(name, size, instructions, config),
+                              file=sys.stderr)
+                        continue
+
+                    if config == "baseline":
+                        baseline_rss = measured["peak_rss"]
+                        continue
+
+                    passes = measured["passes"]
+                    ours = {short: passes[long]["wall_s"] for long, short in PASS_NAMES.items() if long in passes}
+                    # Analyses the passes need (ScalarEvolution, LoopInfo, ...) and the verifier
+                    other = measured["total_s"] - sum(ours.values())
+                    entry.update({
+                        "arit_s": ours.get("matf-arit-sr", 0.0),
+                        "iv_s": ours.get("matf-iv-sr", 0.0),
+                        "other_s": other,
+                        "total_s": measured["total_s"],
+                        "peak_rss_bytes": measured["peak_rss"],
+                        "extra_rss_bytes": measured["peak_rss"] - baseline_rss if baseline_rss else None,
+                        "passes": passes,
+                    })
+                    entry["growth"] = {key: growth_exponent(previous.setdefault(config, []), entry, key)
+                                       for key in GROWTH_KEYS}
+                    previous[config].append(entry)
+                    results.append(entry)
+
+                    flagged = [key for key, growth in entry["growth"].items()
+                               if growth is not None and growth > args.max_exponent]
+                    for key in flagged:
+                        superlinear.append("{} {} {} at {} instructions: exponent {:.2f}".format(
+                            name, config, key, instructions, entry["growth"][key]))
+                    # The largest exponent is shown, the JSON has all of them
+                    growths = [growth for growth in entry["growth"].values() if growth is not None]
+
+                    print("{:<10} {:>6} {:>7} {:<14} {:>9.4f} {:>9.4f} {:>9.4f} {:>9.4f} {:>9.1f} {:>9.1f} {:>7} {}".format(
+                        name, size, instructions, config, entry["arit_s"], entry["iv_s"], other,
+                        entry["total_s"], entry["peak_rss_bytes"] / 2**20, (entry["extra_rss_bytes"] or 0) / 2**20,
+                        "{:.2f}".format(max(growths)) if growths else "-",
+                        "SUPERLINEAR ({})".format(", ".join(flagged)) if flagged else ""), file=sys.stderr)
+    finally:
+        if args.keep:
+            print("generated modules kept in " + work_dir, file=sys.stderr)
+        else:
+            shutil.rmtree(work_dir)
+
+    return {
+        "commit": git_commit(),
+        "date": datetime.datetime.now().isoformat(timespec="seconds"),
+        "host": platform.node(),
+        "machine": platform.machine(),
+        "repeat": args.repeat,
+        "scale": args.scale,
+        "configs": {config: CONFIGS[config] for config in args.configs},
+        "results": results,
+        "superlinear": superlinear,
+    }
+
+
+def git_commit():
+    try:
+        result = subprocess.run(["git", "-C", SCRIPT_DIR, "rev-parse", "HEAD"], capture_output=True, text=True)
+        return result.stdout.strip() or None
+    except OSError:
+        return None
+
+
+def compare(old_path, new_path):
+    with open(old_path) as old_file, open(new_path) as new_file:
+        old, new = json.load(old_file), json.load(new_file)
+
+    def key(result):
+        return result["generator"], result["size"], result["config"]
+
+    old_results = {key(r): r for r in old["results"] if "total_s" in r}
+    print("{:<10} {:>6} {:<14} {:>10} {:>10} {:>8} {:>10} {:>10}".format(
+        "generator", "size", "config", "old [s]", "new [s]", "change", "old [MB]", "new [MB]"))
+    for result in new["results"]:
+        if "total_s" not in result or key(result) not in old_results:
+            continue
+        previous = old_results[key(result)]
+        change = (result["total_s"] - previous["total_s"]) / previous["total_s"] * 100 if previous["total_s"] else 0
+        print("{:<10} {:>6} {:<14} {:>10.4f} {:>10.4f} {:>+7.1f}% {:>10.1f} {:>10.1f}".format(
+            *key(result), previous["total_s"], result["total_s"], change,
+            previous["peak_rss_bytes"] / 2**20, result["peak_rss_bytes"] / 2**20))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--build-dir", default=DEFAULT_BUILD_DIR, help="LLVM build directory")
+    parser.add_argument("--opt", help="path to opt (default: <build-dir>/bin/opt)")
+    parser.add_argument("--plugin", help="path to MatfStrengthReductionPass.so (default: <build-dir>/lib)")
+    parser.add_argument("--generators", nargs="+", choices=list(GENERATORS), default=list(GENERATORS))
+    parser.add_argument("--configs", nargs="+", choices=[c for c in CONFIGS if c != "baseline"],
+                        default=[c for c in CONFIGS if c != "baseline"])
+    parser.add_argument("--scale", type=float, default=1.0, help="multiply the default sizes by this")
+    parser.add_argument("--repeat", type=int, default=3, help="runs of every module, the best one is kept")
+    parser.add_argument("--max-exponent", type=float, default=1.3,
+                        help="growth exponents over this are reported as superlinear")
+    parser.add_argument("--check", action="store_true", help="exit with an error if anything is superlinear")
+    parser.add_argument("-o", "--output", help="write the JSON results here (default: stdout)")
+    parser.add_argument("-k", "--keep", action="store_true", help="keep the generated modules")
+    parser.add_argument("--compare", nargs=2, metavar=("OLD", "NEW"), help="compare two JSON result files")
+    args = parser.parse_args()
+
+    if args.compare:
+        compare(*args.compare)
+        return
+
+    args.opt = args.opt or os.path.join(args.build_dir, "bin", "opt")
+    args.plugin = args.plugin or os.path.join(args.build_dir, "lib", "MatfStrengthReductionPass.so")
+    args.repeat = max(args.repeat, 1)
+
+    results = benchmark(args)
+    report = json.dumps(results, indent=2)
+    if args.output:
+        with open(args.output, "w") as output:
+            output.write(report + "\n")
+    else:
+        print(report)
+
+    for line in results["superlinear"]:
+        print("superlinear: " + line, file=sys.stderr)
+    if args.check and results["superlinear"]:
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
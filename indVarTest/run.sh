@@ -20,7 +20,6 @@ opt -S               \
     -load "$lib"     \
     -mem2reg         \
     "$pass"          \
-    -dce             \
     -enable-new-pm=0 \
     "$llprog"        \
     -o "primer_opt.ll"